@@ -0,0 +1,103 @@
+#pragma once
+
+#include "value_array.hpp"
+#include <type_traits>
+
+namespace safe {
+
+template <std::size_t I>
+using index_constant = std::integral_constant<std::size_t, I>;
+
+// A fixed-size array, the safe counterpart to std::array.
+// Compile-time indices are checked with static_assert, so get<I>() and
+// operator[](index_constant<I>) have no run-time bounds check. Run-time
+// indices are still checked. Since N is known, the borrow state is stored
+// inline with one byte per element.
+template <typename T, std::size_t N, typename Mode = mode> class array {
+  using lifetimes_type = detail::compact_lifetimes<Mode, N>;
+
+public:
+  using value_type = T;
+  using size_type = std::size_t;
+  using checks = detail::index_checks<Mode>;
+  using reference = detail::compact_ref<T, lifetimes_type>;
+  using const_reference = detail::compact_ref<const T, lifetimes_type>;
+  using bulk_reader = detail::bulk_reader<T, lifetimes_type, Mode>;
+
+  array() : values{}, lifetimes(N) {}
+
+  template <typename... Args>
+    requires(sizeof...(Args) > 0 && sizeof...(Args) <= N &&
+             (std::is_convertible_v<Args, T> && ...))
+  explicit(sizeof...(Args) == 1) array(Args &&...args)
+      : values{std::forward<Args>(args)...}, lifetimes(N) {}
+
+  array(const array &other) : lifetimes(N) {
+    auto r = other.read_all();
+    std::copy(r.begin(), r.end(), values.begin());
+  }
+
+  array &operator=(const array &other) {
+    if (this != &other) {
+      auto r = other.read_all();
+      for (size_type i = 0; i < N; ++i)
+        write(i) = r[i];
+    }
+    return *this;
+  }
+
+  ~array() { lifetimes.terminate_if_live(N); }
+
+  static constexpr size_type size() { return N; }
+
+  template <size_type I> reference get() {
+    static_assert(I < N, "index out of range");
+    return {values[I], lifetimes.get(I)};
+  }
+
+  template <size_type I> const_reference get() const {
+    static_assert(I < N, "index out of range");
+    return {values[I], lifetimes.get(I)};
+  }
+
+  template <size_type I> reference operator[](index_constant<I>) {
+    return get<I>();
+  }
+
+  template <size_type I> const_reference operator[](index_constant<I>) const {
+    return get<I>();
+  }
+
+  reference write(size_type i) {
+    checks::check_size(N, i);
+    return {values[i], lifetimes.get(i)};
+  }
+
+  const_reference read(size_type i) const {
+    checks::check_size(N, i);
+    return {values[i], lifetimes.get(i)};
+  }
+
+  reference operator[](size_type i) { return write(i); }
+  const_reference operator[](size_type i) const { return read(i); }
+
+  reference at(size_type i) {
+    if (i >= N)
+      throw std::out_of_range("out of range");
+    return {values[i], lifetimes.get(i)};
+  }
+
+  const_reference at(size_type i) const {
+    if (i >= N)
+      throw std::out_of_range("out of range");
+    return {values[i], lifetimes.get(i)};
+  }
+
+  bulk_reader read_all() const { return {values.data(), N, lifetimes}; }
+
+private:
+  std::array<T, N> values;
+  [[no_unique_address]] mutable lifetimes_type lifetimes;
+};
+
+} // namespace safe
@@ -0,0 +1,332 @@
+#pragma once
+
+#include "value.hpp"
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+namespace safe {
+
+class executor;
+
+namespace detail {
+class waiter_queue;
+}
+
+// A coroutine that is run by an executor, and that can co_await borrows
+class task {
+public:
+  struct promise_type {
+    task get_return_object() {
+      return {std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception();
+  };
+
+  task(task &&other) : handle(other.handle) { other.handle = {}; }
+  task(const task &) = delete;
+
+  ~task() {
+    if (handle)
+      handle.destroy();
+  }
+
+private:
+  friend class executor;
+  task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+// A single-threaded executor that runs tasks until they all finish or wait.
+// Tasks that are waiting for a borrow are posted back to their executor when
+// the borrow is released, and run by the next call to run(). Destroying the
+// executor destroys the tasks that have not finished, including the tasks
+// that are waiting, which releases their borrows.
+class executor {
+public:
+  executor() {}
+  executor(const executor &) = delete;
+
+  ~executor();
+
+  void spawn(task t) {
+    ready.push_back(t.handle);
+    t.handle = {};
+    ++unfinished;
+  }
+
+  void post(std::coroutine_handle<> h) { ready.push_back(h); }
+
+  // Runs until there are no tasks ready to run.
+  // Rethrows exceptions thrown by tasks.
+  void run() {
+    auto previous = active;
+    active = this;
+    while (!ready.empty()) {
+      auto h = ready.front();
+      ready.pop_front();
+      h.resume();
+      if (h.done()) {
+        h.destroy();
+        --unfinished;
+      }
+      if (error) {
+        active = previous;
+        std::rethrow_exception(std::exchange(error, nullptr));
+      }
+    }
+    active = previous;
+  }
+
+  // The number of tasks that have not finished
+  std::size_t pending() const { return unfinished; }
+
+  // The executor running on this thread, or nullptr
+  static executor *current() { return active; }
+
+  // The executor running the awaiting coroutine.
+  // Throws std::logic_error outside of run().
+  static executor &awaiting() {
+    if (!active)
+      throw std::logic_error("co_await outside of executor::run()");
+    return *active;
+  }
+
+private:
+  friend struct task::promise_type;
+  friend class detail::waiter_queue;
+
+  std::deque<std::coroutine_handle<>> ready;
+  std::size_t unfinished = 0;
+  std::exception_ptr error;
+
+  // The number of tasks waiting in each queue
+  std::unordered_map<detail::waiter_queue *, std::size_t> parked;
+  static inline thread_local executor *active = nullptr;
+};
+
+inline void task::promise_type::unhandled_exception() {
+  auto e = executor::current();
+  if (!e)
+    throw; // Not run by an executor, so the caller of resume() gets it
+  e->error = std::current_exception();
+}
+
+// co_await yield() lets the other ready tasks run first
+inline auto yield() {
+  struct awaiter {
+    bool await_ready() { return false; }
+    void await_suspend(std::coroutine_handle<> h) {
+      executor::awaiting().post(h);
+    }
+    void await_resume() {}
+  };
+  return awaiter{};
+}
+
+namespace detail {
+
+// Coroutines waiting to borrow a lifetime, in the order that they waited.
+// Waiters are woken in order: a writer when there are no borrows, or readers
+// until the next writer. A woken waiter is granted its borrow and posted to
+// the executor that it was running on.
+class waiter_queue {
+public:
+  ~waiter_queue() {
+    if (!waiters.empty())
+      std::terminate();
+  }
+
+  bool empty() const { return waiters.empty(); }
+
+  void push(std::coroutine_handle<> h, bool write, bool &granted) {
+    auto &e = executor::awaiting();
+    waiters.push_back({h, write, &granted, &e});
+    ++e.parked[this];
+  }
+
+  void wake(lifetime<checked> &life) {
+    while (!waiters.empty()) {
+      auto w = waiters.front();
+      if (w.write ? life.readers || life.writers : life.writers != 0)
+        return;
+      if (w.write)
+        exclusive_write::acquire(life);
+      else
+        shared_read::acquire(life);
+      *w.granted = true;
+      waiters.pop_front();
+      unpark(*w.owner);
+      w.owner->post(w.handle);
+    }
+  }
+
+  // Removes the waiters of an executor that is being destroyed
+  std::vector<std::coroutine_handle<>> cancel(executor &e) {
+    std::vector<std::coroutine_handle<>> result;
+    std::erase_if(waiters, [&](auto &w) {
+      if (w.owner != &e)
+        return false;
+      result.push_back(w.handle);
+      return true;
+    });
+    e.parked.erase(this);
+    return result;
+  }
+
+private:
+  void unpark(executor &e) {
+    if (--e.parked[this] == 0)
+      e.parked.erase(this);
+  }
+
+  struct waiter {
+    std::coroutine_handle<> handle;
+    bool write;
+    bool *granted; // Set when the borrow is acquired for the waiter
+    executor *owner;
+  };
+
+  std::deque<waiter> waiters;
+};
+
+} // namespace detail
+
+// Destroying a task releases its borrows, which can post other tasks
+inline executor::~executor() {
+  for (;;) {
+    if (!ready.empty()) {
+      auto h = ready.front();
+      ready.pop_front();
+      h.destroy();
+    } else if (!parked.empty()) {
+      for (auto h : parked.begin()->first->cancel(*this))
+        h.destroy();
+    } else {
+      break;
+    }
+  }
+}
+
+template <typename T> class async_value;
+
+// A borrow of an async_value. Releasing it wakes the coroutines waiting for
+// the value.
+template <typename T> class async_ref {
+  using value_type = std::remove_const_t<T>;
+  using op =
+      std::conditional_t<std::is_const_v<T>, shared_read, exclusive_write>;
+
+public:
+  async_ref(async_ref &&other) : owner(other.owner) { other.owner = nullptr; }
+  async_ref(const async_ref &) = delete;
+
+  ~async_ref() {
+    if (owner) {
+      op::release(owner->life);
+      owner->waiters.wake(owner->life);
+    }
+  }
+
+  T &operator*() const { return owner->item; }
+  T *operator->() const { return &owner->item; }
+
+private:
+  friend class async_value<value_type>;
+  async_ref(async_value<value_type> &owner) : owner(&owner) {}
+
+  async_value<value_type> *owner;
+};
+
+// A value that coroutines can borrow with co_await.
+// co_await async_read() and co_await async_write() suspend the coroutine
+// whilst the borrow conflicts with another borrow, instead of throwing, and
+// resume it when the conflicting borrows are released. Waiters are served in
+// order, so writers are not starved by readers. read() and write() throw
+// invalid_read and invalid_write on conflicts, as for value<T>.
+//
+// Borrows are always counted, since suspending depends on them, and the
+// value is only for coroutines on a single thread.
+template <typename T> class async_value {
+public:
+  using value_type = T;
+
+  template <typename Op> class awaiter {
+  public:
+    awaiter(const awaiter &) = delete;
+
+    // Releases a borrow that was granted to a task that was destroyed before
+    // it resumed
+    ~awaiter() {
+      if (granted) {
+        Op::release(owner.life);
+        owner.waiters.wake(owner.life);
+      }
+    }
+
+    bool await_ready() {
+      if (!owner.waiters.empty())
+        return false;
+      auto &life = owner.life;
+      if (std::is_same_v<Op, exclusive_write> ? life.readers || life.writers
+                                              : life.writers != 0)
+        return false;
+      Op::acquire(life);
+      granted = true;
+      return true;
+    }
+
+    void await_suspend(std::coroutine_handle<> h) {
+      owner.waiters.push(h, std::is_same_v<Op, exclusive_write>, granted);
+    }
+
+    // The borrow was acquired by await_ready() or by the waiter queue
+    auto await_resume() {
+      using ref_type = std::conditional_t<std::is_same_v<Op, shared_read>,
+                                          async_ref<const T>, async_ref<T>>;
+      granted = false;
+      return ref_type(owner);
+    }
+
+  private:
+    friend class async_value;
+    awaiter(async_value &owner) : owner(owner) {}
+    async_value &owner;
+    bool granted = false;
+  };
+
+  template <typename... Args>
+  async_value(Args &&...args) : item(std::forward<Args>(args)...) {}
+
+  async_value(const async_value &) = delete;
+
+  awaiter<shared_read> async_read() { return {*this}; }
+  awaiter<exclusive_write> async_write() { return {*this}; }
+
+  async_ref<const T> read() {
+    shared_read::acquire(life);
+    return {*this};
+  }
+
+  async_ref<T> write() {
+    exclusive_write::acquire(life);
+    return {*this};
+  }
+
+private:
+  friend class async_ref<T>;
+  friend class async_ref<const T>;
+
+  T item;
+  detail::lifetime<checked> life;
+  detail::waiter_queue waiters;
+};
+
+} // namespace safe
@@ -1,6 +1,71 @@
 #pragma once
 
-namespace safe
-{
-    
-}
\ No newline at end of file
+#include "value.hpp"
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <utility>
+
+namespace safe {
+
+namespace detail {
+
+// An object that is read or written, see reads() and writes()
+template <typename T, bool Write> struct access {
+  T &object;
+
+  const void *address() const { return std::addressof(object); }
+
+  auto acquire() const {
+    if constexpr (Write)
+      return object.write();
+    else
+      return object.read();
+  }
+};
+
+template <std::size_t... I, typename... Access>
+auto borrow_in_order(std::index_sequence<I...>, Access... access) {
+  constexpr std::size_t n = sizeof...(I);
+  std::array<const void *, n> addresses = {access.address()...};
+  std::array<std::size_t, n> order = {I...};
+  std::stable_sort(order.begin(), order.end(), [&](auto a, auto b) {
+    return std::less<const void *>()(addresses[a], addresses[b]);
+  });
+
+  // Borrows taken before a failure are released when taken is destroyed
+  std::tuple<std::optional<decltype(access.acquire())>...> taken;
+  for (auto k : order)
+    ((k == I ? (void)std::get<I>(taken).emplace(access.acquire()) : void()),
+     ...);
+  return std::tuple<decltype(access.acquire())...>(
+      std::move(*std::get<I>(taken))...);
+}
+
+} // namespace detail
+
+// Declares that an object is read
+template <typename T> detail::access<const T, false> reads(const T &object) {
+  return {object};
+}
+
+// Declares that an object is written
+template <typename T> detail::access<T, true> writes(T &object) {
+  return {object};
+}
+
+// Borrows several objects as one step, for example
+//   auto [from, to] = safe::borrow_all(safe::writes(a), safe::writes(b));
+// Returns a tuple of the borrows, in the order of the arguments. The objects
+// are borrowed in order of address, so every call borrows a given set of
+// objects in the same order. If any borrow throws, the borrows already taken
+// are released before the exception propagates, so nothing stays borrowed.
+template <typename... T, bool... Write>
+auto borrow_all(detail::access<T, Write>... access) {
+  return detail::borrow_in_order(std::index_sequence_for<T...>{}, access...);
+}
+
+} // namespace safe
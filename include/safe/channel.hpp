@@ -0,0 +1,177 @@
+#pragma once
+
+#include "container.hpp"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+
+namespace safe {
+
+namespace detail {
+
+// Moves a value out, after checking that it is not borrowed.
+// Safe values and containers throw invalid_write if they are borrowed, and
+// are left unchanged.
+template <typename T> struct ownership {
+  static T take(T &src) { return std::move(src); }
+};
+
+template <typename T, typename Mode> struct ownership<value<T, Mode>> {
+  static value<T, Mode> take(value<T, Mode> &src) {
+    auto w = src.write();
+    return value<T, Mode>(std::move(**w));
+  }
+};
+
+template <typename C, typename Mode> struct ownership<container<C, Mode>> {
+  static container<C, Mode> take(container<C, Mode> &src) {
+    auto w = src.write();
+    return container<C, Mode>(std::move(src));
+  }
+};
+
+} // namespace detail
+
+// A bounded queue that transfers ownership of values between threads, with
+// any number of senders and receivers.
+// send() moves the value into the channel, after checking that it is not
+// borrowed, so the receiver owns the value and no borrows are shared between
+// threads. close() wakes all waiting threads. Receiving from a closed channel
+// returns the remaining values and then nothing, and sending to a closed
+// channel throws closed_channel.
+template <typename T> class channel {
+public:
+  using value_type = T;
+  using size_type = std::size_t;
+
+  explicit channel(size_type capacity) : cap(capacity) {
+    if (capacity == 0)
+      throw std::invalid_argument("channel capacity must be positive");
+  }
+
+  channel(const channel &) = delete;
+  channel &operator=(const channel &) = delete;
+
+  // Waits until there is space. Throws invalid_write if the value is borrowed.
+  void send(T &&v) {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_full.wait(lock, [&] { return is_closed || items.size() < cap; });
+    push(v);
+  }
+
+  // Returns false, and does not move the value, if the channel is full.
+  // Throws invalid_write if the value is borrowed.
+  bool try_send(T &&v) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!is_closed && items.size() == cap)
+      return false;
+    push(v);
+    return true;
+  }
+
+  // Moves the values of an rvalue range into the channel, in order, waiting
+  // for space as needed. Returns the number of values sent. If the channel is
+  // closed part way, the values after those sent are not moved. Throws
+  // invalid_write if a value is borrowed, after sending the values before it.
+  template <typename Range>
+    requires(!std::is_lvalue_reference_v<Range>)
+  size_type send_all(Range &&values) {
+    std::unique_lock<std::mutex> lock(mutex);
+    size_type sent = 0;
+    for (auto &v : values) {
+      not_full.wait(lock, [&] { return is_closed || items.size() < cap; });
+      if (is_closed)
+        break;
+      push(v);
+      ++sent;
+    }
+    return sent;
+  }
+
+  // Waits for a value. Returns nothing if the channel is closed and empty.
+  std::optional<T> recv() {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_empty.wait(lock, [&] { return is_closed || !items.empty(); });
+    return pop();
+  }
+
+  std::optional<T> try_recv() {
+    std::unique_lock<std::mutex> lock(mutex);
+    return pop();
+  }
+
+  // Waits for at least one value, and then receives up to max values.
+  // Returns the number received, which is 0 if the channel is closed and
+  // empty.
+  template <typename OutputIt> size_type recv_many(OutputIt out, size_type max) {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_empty.wait(lock, [&] { return is_closed || !items.empty(); });
+    return pop_many(out, max);
+  }
+
+  template <typename OutputIt>
+  size_type try_recv_many(OutputIt out, size_type max) {
+    std::unique_lock<std::mutex> lock(mutex);
+    return pop_many(out, max);
+  }
+
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      is_closed = true;
+    }
+    not_full.notify_all();
+    not_empty.notify_all();
+  }
+
+  bool closed() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return is_closed;
+  }
+
+  size_type size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return items.size();
+  }
+
+  size_type capacity() const { return cap; }
+
+private:
+  // The value is unchanged if this throws
+  void push(T &v) {
+    if (is_closed)
+      throw closed_channel();
+    items.push_back(detail::ownership<T>::take(v));
+    not_empty.notify_one();
+  }
+
+  std::optional<T> pop() {
+    if (items.empty())
+      return {};
+    std::optional<T> result(std::move(items.front()));
+    items.pop_front();
+    not_full.notify_one();
+    return result;
+  }
+
+  template <typename OutputIt> size_type pop_many(OutputIt out, size_type max) {
+    size_type n = std::min(max, items.size());
+    for (size_type i = 0; i < n; ++i) {
+      *out++ = std::move(items.front());
+      items.pop_front();
+    }
+    if (n > 0)
+      not_full.notify_all();
+    return n;
+  }
+
+  const size_type cap;
+  bool is_closed = false;
+  std::deque<T> items;
+  mutable std::mutex mutex;
+  std::condition_variable not_full, not_empty;
+};
+
+} // namespace safe
@@ -0,0 +1,175 @@
+#pragma once
+
+#include "stable_vector.hpp"
+
+namespace safe {
+
+// An append-only vector that can be appended to from many threads at once.
+// Appends borrow the container for reading, so concurrent appends do not
+// conflict with each other or with readers, but do conflict with clear().
+// Elements are published once constructed, and elements that are still being
+// constructed are reported as out of range.
+template <typename T, typename Mode = mode> class concurrent_vector {
+  struct slot {
+    std::atomic<bool> ready = false;
+    alignas(T) unsigned char storage[sizeof(T)];
+
+    T &get() { return *std::launder(reinterpret_cast<T *>(storage)); }
+  };
+
+public:
+  using value_type = T;
+  using size_type = std::size_t;
+  using lifetime_type = detail::lifetime<Mode>;
+  using checks = detail::index_checks<Mode>;
+
+  class const_iterator {
+  public:
+    const_iterator() : vec{}, index{} {}
+
+    const_iterator(const concurrent_vector *vec, size_type index)
+        : vec(vec), index(index), container_lock(vec->container_lifetime()) {}
+
+    ref<const value_type, Mode> operator*() const {
+      if (!vec)
+        throw std::out_of_range("uninitialized iterator");
+      return (*vec)[index];
+    }
+
+    const_iterator &operator++() {
+      if (!vec)
+        throw std::out_of_range("uninitialized iterator");
+      checks::check_size(vec->size() + 1, index + 1);
+      ++index;
+      return *this;
+    }
+
+    bool operator==(const const_iterator &other) const {
+      return index == other.index;
+    }
+    bool operator!=(const const_iterator &other) const {
+      return index != other.index;
+    }
+
+  private:
+    const concurrent_vector *vec;
+    size_type index;
+    detail::optional_lock<shared_read, Mode> container_lock;
+  };
+
+  using iterator = const_iterator;
+
+  concurrent_vector() : segments{}, reserved(0) {}
+
+  concurrent_vector(const concurrent_vector &) = delete;
+  concurrent_vector &operator=(const concurrent_vector &) = delete;
+
+  ~concurrent_vector() {
+    element_access.terminate_if_live();
+    container_access.terminate_if_live();
+    destroy();
+  }
+
+  // The number of elements appended so far, including any that are still
+  // being constructed.
+  size_type size() const { return reserved.load(std::memory_order_acquire); }
+  bool empty() const { return size() == 0; }
+
+  // Thread-safe. Returns the index of the new element.
+  template <typename... Args> size_type emplace_back(Args &&...args) {
+    detail::lock<shared_read, Mode> lock(container_access.get_lifetime());
+    auto n = reserved.fetch_add(1, std::memory_order_acq_rel);
+    detail::segment_index idx(n);
+    auto &s = get_segment(idx.segment)[idx.offset];
+    std::construct_at(&s.get(), std::forward<Args>(args)...);
+    s.ready.store(true, std::memory_order_release);
+    return n;
+  }
+
+  size_type push_back(const value_type &v) { return emplace_back(v); }
+  size_type push_back(value_type &&v) { return emplace_back(std::move(v)); }
+
+  ref<value_type, Mode> operator[](size_type i) {
+    return {get(i), element_access.get_lifetime()};
+  }
+
+  ref<const value_type, Mode> operator[](size_type i) const {
+    return {get(i), element_access.get_lifetime()};
+  }
+
+  ref<value_type, Mode> at(size_type i) {
+    if (i >= size())
+      throw std::out_of_range("out of range");
+    return {get(i), element_access.get_lifetime()};
+  }
+
+  ref<const value_type, Mode> at(size_type i) const {
+    if (i >= size())
+      throw std::out_of_range("out of range");
+    return {get(i), element_access.get_lifetime()};
+  }
+
+  // Not thread-safe: requires that there are no appenders, iterators or
+  // element references.
+  void clear() {
+    detail::lock<exclusive_write, Mode> container(
+        container_access.get_lifetime());
+    detail::lock<exclusive_write, Mode> elements(element_access.get_lifetime());
+    destroy();
+  }
+
+  const_iterator begin() const { return {this, 0}; }
+  const_iterator end() const { return {this, size()}; }
+
+  typename lifetime_type::reference container_lifetime() const {
+    return container_access.get_lifetime();
+  }
+
+  typename lifetime_type::reference element_lifetime() const {
+    return element_access.get_lifetime();
+  }
+
+private:
+  // Returns the segment, allocating it if necessary.
+  slot *get_segment(size_type s) {
+    auto p = segments[s].load(std::memory_order_acquire);
+    if (p)
+      return p;
+    auto fresh = new slot[detail::segment_index::segment_size(s)];
+    if (segments[s].compare_exchange_strong(p, fresh,
+                                            std::memory_order_acq_rel)) {
+      return fresh;
+    }
+    delete[] fresh; // Another thread allocated the segment first
+    return p;
+  }
+
+  value_type &get(size_type i) const {
+    checks::check_size(size(), i);
+    detail::segment_index idx(i);
+    auto segment = segments[idx.segment].load(std::memory_order_acquire);
+    if (!segment || !segment[idx.offset].ready.load(std::memory_order_acquire))
+      throw std::out_of_range("element not yet published");
+    return segment[idx.offset].get();
+  }
+
+  void destroy() {
+    for (size_type s = 0; s < segments.size(); ++s) {
+      auto p = segments[s].exchange(nullptr);
+      if (!p)
+        continue;
+      for (size_type i = 0; i < detail::segment_index::segment_size(s); ++i)
+        if (p[i].ready)
+          std::destroy_at(&p[i].get());
+      delete[] p;
+    }
+    reserved = 0;
+  }
+
+  std::array<std::atomic<slot *>, detail::segment_index::max_segments>
+      segments;
+  std::atomic<size_type> reserved;
+  mutable detail::lifetime<Mode> container_access, element_access;
+};
+
+} // namespace safe
@@ -1,13 +1,43 @@
 #pragma once
 
 #include "value.hpp"
+#include <array>
+#include <iterator>
 
 namespace safe {
 
 namespace detail {
+
+// Reads and writes the elements of containers, see serialize.hpp
+struct serializer;
+
+// Index checks for containers that do not wrap a standard container
+template <typename Mode> struct index_checks {
+  static void check_size(std::size_t size, std::size_t i) {}
+};
+
+template <> struct index_checks<checked> {
+  static void check_size(std::size_t size, std::size_t i) {
+    if (i >= size)
+      throw std::out_of_range("out of range");
+  }
+};
+
+// ASCII case conversion over a whole buffer, written without branches or
+// locale calls so that the loop can be vectorized.
+template <typename CharT> void to_lower(CharT *p, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i)
+    p[i] += (p[i] >= 'A' && p[i] <= 'Z') * ('a' - 'A');
+}
+
+template <typename CharT> void to_upper(CharT *p, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i)
+    p[i] -= (p[i] >= 'a' && p[i] <= 'z') * ('a' - 'A');
+}
+
 template <typename Container, typename Mode,
-          typename IteratorCategory =
-              typename Container::const_iterator::iterator_category>
+          typename IteratorCategory = typename std::iterator_traits<
+              typename Container::const_iterator>::iterator_category>
 struct iterator_checks {
   static void check_deref(const Container &container,
                           const typename Container::const_iterator &it) {}
@@ -312,7 +342,47 @@ public:
 
   size_type size() const { return value.size(); }
 
+  // String operations
+  // These borrow once for the whole operation, and use the bulk operations of
+  // the underlying string. They also check that no elements are borrowed for
+  // writing.
+
+  template <typename S> size_type find(const S &s, size_type pos = 0) const {
+    auto elements = read_elements();
+    return value.container.find(s, pos);
+  }
+
+  template <typename S>
+  size_type rfind(const S &s, size_type pos = C::npos) const {
+    auto elements = read_elements();
+    return value.container.rfind(s, pos);
+  }
+
+  template <typename S> int compare(const S &s) const {
+    auto elements = read_elements();
+    return value.container.compare(s);
+  }
+
+  template <typename S> bool starts_with(const S &s) const {
+    auto elements = read_elements();
+    return value.container.starts_with(s);
+  }
+
+  template <typename S> bool ends_with(const S &s) const {
+    auto elements = read_elements();
+    return value.container.ends_with(s);
+  }
+
+  template <typename S> bool contains(const S &s) const {
+    auto elements = read_elements();
+    return value.container.find(s) != C::npos;
+  }
+
 private:
+  detail::lock<shared_read, Mode> read_elements() const {
+    return {value.element_lifetime()};
+  }
+
   const impl_type &value;
   detail::lock<shared_read, Mode> life;
 };
@@ -331,6 +401,8 @@ public:
       : value(value), life(life) {}
   ref(container<C, Mode> &src) : ref(src.write()) {}
   ref(const ref &other) : value(other.value), life(other.reader) {}
+  ref(ref &&other)
+      : value(other.value), life(other.lifetime(), detail::move_tag{}) {}
   // mut(object<value_type,Mode>&obj) : mut(obj.unsafe_read(), obj.lifetime())
   // {} mut(shared_object<value_type,Mode>&);
 
@@ -375,23 +447,144 @@ public:
   }
 
   size_type size() const { return read().size(); }
-  void resize(size_type s) { write()->resize(s); }
+
+  // These can move or destroy elements, so they also check that no elements
+  // are borrowed
+  void resize(size_type s) { write_elements()->container.resize(s); }
 
   template <typename... Args> void emplace_back(Args &&...args) {
-    write()->emplace_back(std::forward<Args>(args)...);
+    write_elements()->container.emplace_back(std::forward<Args>(args)...);
+  }
+
+  void push_back(const value_type &v) {
+    write_elements()->container.push_back(v);
+  }
+
+  void clear() { write_elements()->container.clear(); }
+
+  // String operations
+  // These borrow once for the whole operation. Operations that modify the
+  // string also check that no elements are borrowed.
+
+  template <typename S> size_type find(const S &s, size_type pos = 0) const {
+    return read().find(s, pos);
+  }
+
+  template <typename S>
+  size_type rfind(const S &s, size_type pos = C::npos) const {
+    return read().rfind(s, pos);
+  }
+
+  template <typename S> int compare(const S &s) const {
+    return read().compare(s);
+  }
+
+  template <typename S> bool starts_with(const S &s) const {
+    return read().starts_with(s);
   }
 
-  void push_back(const value_type &v) { write()->push_back(v); }
+  template <typename S> bool ends_with(const S &s) const {
+    return read().ends_with(s);
+  }
 
-  void clear() { write()->clear(); }
+  template <typename S> bool contains(const S &s) const {
+    return read().contains(s);
+  }
+
+  template <typename S> ref &append(const S &s) {
+    write_elements()->container.append(s);
+    return *this;
+  }
+
+  template <typename S> ref &operator+=(const S &s) { return append(s); }
+
+  template <typename S> ref &insert(size_type pos, const S &s) {
+    write_elements()->container.insert(pos, s);
+    return *this;
+  }
+
+  template <typename S>
+  ref &replace(size_type pos, size_type n, const S &s) {
+    write_elements()->container.replace(pos, n, s);
+    return *this;
+  }
+
+  ref &erase(size_type pos, size_type n = C::npos) {
+    write_elements()->container.erase(pos, n);
+    return *this;
+  }
+
+  void to_lower() {
+    auto w = write_elements();
+    detail::to_lower(w->container.data(), w->container.size());
+  }
+
+  void to_upper() {
+    auto w = write_elements();
+    detail::to_upper(w->container.data(), w->container.size());
+  }
 
 private:
+  struct elements_write : exclusive<container_type, Mode> {
+    elements_write(container_type &value,
+                   typename lifetime_type::reference reader)
+        : exclusive<container_type, Mode>(value, reader),
+          elements(value.element_lifetime()) {}
+    detail::lock<exclusive_write, Mode> elements;
+  };
+
+  elements_write write_elements() const { return {value, reader.get_lifetime()}; }
+
   friend class ref<const container<C, Mode>, Mode>;
   container_type &value;
   detail::lock<exclusive_write, Mode> life;
   mutable detail::lifetime<Mode> reader; // Track readers/writers of this writer
 };
 
+// Mutable borrows of distinct elements of a container, see
+// container::get_many(). Each element has its own lifetime, so the elements
+// can be written at the same time, whilst the container's element lifetime is
+// borrowed exclusively for as long as this object exists.
+template <typename T, std::size_t N, typename Mode> class element_borrows {
+public:
+  using value_type = T;
+  using size_type = std::size_t;
+
+  static constexpr size_type size() { return N; }
+
+  ref<T, Mode> operator[](size_type k) {
+    detail::index_checks<Mode>::check_size(N, k);
+    return {*items[k], lives[k].get_lifetime()};
+  }
+
+  ref<const T, Mode> operator[](size_type k) const {
+    detail::index_checks<Mode>::check_size(N, k);
+    return {*items[k], lives[k].get_lifetime()};
+  }
+
+private:
+  template <typename C, typename M> friend class container;
+
+  template <typename C>
+  element_borrows(detail::container_impl<C, Mode> &c,
+                  std::array<size_type, N> indices)
+      : structure(c.lifetime()), elements(c.element_lifetime()) {
+    for (size_type k = 0; k < N; ++k) {
+      detail::container_impl<C, Mode>::checks::check_size(c.container,
+                                                          indices[k]);
+      for (size_type j = 0; j < k; ++j)
+        if (indices[j] == indices[k])
+          throw invalid_write();
+      items[k] = &c.container[indices[k]];
+    }
+  }
+
+  detail::lock<shared_read, Mode> structure;
+  detail::lock<exclusive_write, Mode> elements;
+  std::array<T *, N> items;
+  mutable std::array<detail::lifetime<Mode>, N> lives;
+};
+
 template <typename C, typename Mode> class container {
 public:
   using container_type = detail::container_impl<C, Mode>; // ??
@@ -469,6 +662,15 @@ public:
   ref<value_type, Mode> back() { return write().back(); }
   ref<const value_type, Mode> back() const { return read().back(); }
 
+  // Borrows several distinct elements for writing at once, for example
+  //   auto e = v.get_many(i, j);
+  //   std::swap(**e[0], **e[1]);
+  // Throws invalid_write if an index is repeated.
+  template <typename... I>
+  element_borrows<value_type, sizeof...(I), Mode> get_many(I... i) {
+    return {value, {static_cast<size_type>(i)...}};
+  }
+
   iterator begin() {
     return {value.container.begin(), &value, value.lifetime()};
   }
@@ -500,11 +702,67 @@ public:
     write().emplace_back(std::forward<Args>(args)...);
   }
 
+  // String operations
+
+  template <typename S> size_type find(const S &s, size_type pos = 0) const {
+    return read().find(s, pos);
+  }
+
+  template <typename S>
+  size_type rfind(const S &s, size_type pos = C::npos) const {
+    return read().rfind(s, pos);
+  }
+
+  template <typename S> int compare(const S &s) const {
+    return read().compare(s);
+  }
+
+  template <typename S> bool starts_with(const S &s) const {
+    return read().starts_with(s);
+  }
+
+  template <typename S> bool ends_with(const S &s) const {
+    return read().ends_with(s);
+  }
+
+  template <typename S> bool contains(const S &s) const {
+    return read().contains(s);
+  }
+
+  template <typename S> container &append(const S &s) {
+    write().append(s);
+    return *this;
+  }
+
+  template <typename S> container &operator+=(const S &s) { return append(s); }
+
+  template <typename S> container &insert(size_type pos, const S &s) {
+    write().insert(pos, s);
+    return *this;
+  }
+
+  template <typename S>
+  container &replace(size_type pos, size_type n, const S &s) {
+    write().replace(pos, n, s);
+    return *this;
+  }
+
+  container &erase(size_type pos, size_type n = C::npos) {
+    write().erase(pos, n);
+    return *this;
+  }
+
+  void to_lower() { write().to_lower(); }
+  void to_upper() { write().to_upper(); }
+
   typename detail::lifetime<Mode>::reference element_lifetime() const {
     return value.element_lifetime();
   }
 
 private:
+  template <typename M> friend class basic_string_view;
+  template <typename C2, typename M> friend class frozen;
+  friend struct detail::serializer;
   container_type value;
 };
 
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "value.hpp"
+#include <atomic>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace safe {
+
+// A copy-on-write value. Copies share one reference-counted payload, and
+// write() copies the payload only if it is shared with another cow.
+// Each cow has its own lifetime, so borrows follow the same rules as value<T>:
+// a shared payload is never modified, so borrows of one copy do not affect
+// the other copies.
+template <typename T, typename Mode = mode> class cow {
+public:
+  using value_type = T;
+  using lifetime_type = detail::lifetime<Mode>;
+  using mode = typename mode_type<Mode>::type;
+
+  template <typename... Args>
+    requires(!(sizeof...(Args) == 1 &&
+               (std::is_same_v<std::remove_cvref_t<Args>, cow> && ...)))
+  cow(Args &&...args)
+      : payload(std::make_shared<T>(std::forward<Args>(args)...)) {}
+
+  // Shares the payload
+  cow(const cow &src) : payload(src.share()) {}
+  cow(cow &&src) : payload(src.share()) {}
+
+  cow &operator=(const cow &src) {
+    if (this != &src) {
+      auto p = src.share();
+      detail::lock<exclusive_write, mode> lock(life.get_lifetime());
+      payload = std::move(p);
+    }
+    return *this;
+  }
+
+  template <typename U>
+    requires(!std::is_same_v<std::remove_cvref_t<U>, cow>)
+  cow &operator=(U &&v) {
+    *write() = std::forward<U>(v);
+    return *this;
+  }
+
+  ref<const T, mode> read() const { return {*payload, life.get_lifetime()}; }
+
+  // Copies the payload if it is shared
+  ref<T, mode> write() {
+    detail::lock<exclusive_write, mode> lock(life.get_lifetime());
+    if (payload.use_count() > 1)
+      payload = std::make_shared<T>(std::as_const(*payload));
+    else
+      // Synchronize with other copies that released the payload
+      std::atomic_thread_fence(std::memory_order_acquire);
+    // The ref takes over the borrow before the lock releases it, so no copy
+    // can share the payload in between
+    return {*payload, life.get_lifetime(), detail::move_tag{}};
+  }
+
+  ref<const T, mode> operator*() const { return read(); }
+  ref<const T, mode> operator->() const { return read(); }
+
+  ref<T, mode> operator*() { return write(); }
+  ref<T, mode> operator->() { return write(); }
+
+  // True if the payload is shared with another cow
+  bool shared() const { return payload.use_count() > 1; }
+
+private:
+  std::shared_ptr<T> share() const {
+    detail::lock<shared_read, mode> lock(life.get_lifetime());
+    return payload;
+  }
+
+  std::shared_ptr<T> payload;
+  mutable lifetime_type life;
+};
+
+} // namespace safe
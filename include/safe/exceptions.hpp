@@ -36,4 +36,14 @@ public:
   expired_pointer() : exception("expired pointer") {}
 };
 
+class invalid_format : public exception {
+public:
+  invalid_format() : exception("invalid format") {}
+};
+
+class closed_channel : public exception {
+public:
+  closed_channel() : exception("closed channel") {}
+};
+
 } // namespace safe
\ No newline at end of file
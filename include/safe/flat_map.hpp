@@ -0,0 +1,217 @@
+#pragma once
+
+#include "container.hpp"
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+namespace safe {
+
+namespace detail {
+
+template <typename T> struct key_of_self {
+  const T &operator()(const T &v) const { return v; }
+};
+
+template <typename P> struct key_of_first {
+  const typename P::first_type &operator()(const P &v) const {
+    return v.first;
+  }
+};
+
+// Sorted contiguous storage shared by flat_map and flat_set.
+// Lookups borrow the container for the duration of the binary search.
+// Insertion and erasure move elements, so they need the same exclusive access
+// as container::write().
+template <typename Key, typename Value, typename KeyOf, typename Compare,
+          typename Mode>
+class flat_tree {
+public:
+  using key_type = Key;
+  using value_type = Value;
+  using impl_type = container_impl<std::vector<Value>, Mode>;
+  using size_type = typename impl_type::size_type;
+  using const_iterator = typename impl_type::const_iterator;
+  using iterator = const_iterator;
+
+  flat_tree() {}
+
+  flat_tree(std::initializer_list<value_type> il)
+      : flat_tree(std::vector<value_type>(il)) {}
+
+  // Builds from unsorted input with a single sort. The first of any
+  // duplicate keys is kept.
+  explicit flat_tree(std::vector<value_type> &&values)
+      : value(std::move(values)) {
+    sort_unique();
+  }
+
+  template <typename InputIt>
+  flat_tree(InputIt first, InputIt last)
+      : flat_tree(std::vector<value_type>(first, last)) {}
+
+  size_type size() const {
+    lock<shared_read, Mode> container(value.lifetime());
+    return value.container.size();
+  }
+
+  bool empty() const { return size() == 0; }
+
+  bool contains(const key_type &key) const {
+    lock<shared_read, Mode> container(value.lifetime());
+    return find(key) != value.container.size();
+  }
+
+  // Looks up every key in [first, last) under a single read borrow, and writes
+  // to `out` whether each key is present. Sorted keys are found faster.
+  template <typename InputIt, typename OutputIt>
+  OutputIt contains(InputIt first, InputIt last, OutputIt out) const {
+    return lookup(first, last, out, [](auto it, auto end) { return it != end; });
+  }
+
+  // Returns true if the element was inserted.
+  bool insert(const value_type &v) {
+    auto w = write();
+    auto &c = value.container;
+    auto it = std::lower_bound(c.begin(), c.end(), KeyOf()(v), compare());
+    if (it != c.end() && !Compare()(KeyOf()(v), KeyOf()(*it)))
+      return false;
+    c.insert(it, v);
+    return true;
+  }
+
+  size_type erase(const key_type &key) {
+    auto w = write();
+    auto &c = value.container;
+    auto it = std::lower_bound(c.begin(), c.end(), key, compare());
+    if (it == c.end() || Compare()(key, KeyOf()(*it)))
+      return 0;
+    c.erase(it);
+    return 1;
+  }
+
+  void clear() {
+    auto w = write();
+    value.container.clear();
+  }
+
+  // Elements cannot be modified through iterators as that would break the
+  // ordering.
+  const_iterator begin() const { return value.begin(); }
+  const_iterator end() const { return value.end(); }
+
+protected:
+  struct write_lock {
+    lock<exclusive_write, Mode> container, elements;
+  };
+
+  write_lock write() {
+    return {value.lifetime(), value.element_lifetime()};
+  }
+
+  static auto compare() {
+    return [](const auto &a, const auto &b) {
+      return Compare()(key(a), key(b));
+    };
+  }
+
+  template <typename T> static const key_type &key(const T &v) {
+    if constexpr (std::is_same_v<T, value_type>)
+      return KeyOf()(v);
+    else
+      return v;
+  }
+
+  // Returns the index of the key, or size() if not found
+  size_type find(const key_type &k) const {
+    auto &c = value.container;
+    auto it = std::lower_bound(c.begin(), c.end(), k, compare());
+    if (it != c.end() && Compare()(k, KeyOf()(*it)))
+      return c.size();
+    return it - c.begin();
+  }
+
+  template <typename InputIt, typename OutputIt, typename Fn>
+  OutputIt lookup(InputIt first, InputIt last, OutputIt out, Fn fn) const {
+    lock<shared_read, Mode> container(value.lifetime());
+    lock<shared_read, Mode> elements(value.element_lifetime());
+    auto &c = value.container;
+    auto from = c.begin();
+    for (; first != last; ++first) {
+      const key_type &k = *first;
+      // Only search the remainder if the keys are ascending
+      if (from != c.begin() && !Compare()(KeyOf()(*(from - 1)), k))
+        from = c.begin();
+      from = std::lower_bound(from, c.end(), k, compare());
+      auto found = from != c.end() && !Compare()(k, KeyOf()(*from))
+                       ? from
+                       : c.end();
+      *out++ = fn(found, c.end());
+    }
+    return out;
+  }
+
+  void sort_unique() {
+    auto &c = value.container;
+    std::stable_sort(c.begin(), c.end(), compare());
+    c.erase(std::unique(c.begin(), c.end(),
+                        [](const auto &a, const auto &b) {
+                          return !Compare()(KeyOf()(a), KeyOf()(b));
+                        }),
+            c.end());
+  }
+
+  impl_type value;
+};
+
+} // namespace detail
+
+// A sorted map stored in a contiguous vector.
+template <typename K, typename V, typename Mode = mode,
+          typename Compare = std::less<K>>
+class flat_map
+    : public detail::flat_tree<K, std::pair<K, V>,
+                               detail::key_of_first<std::pair<K, V>>, Compare,
+                               Mode> {
+  using base = detail::flat_tree<K, std::pair<K, V>,
+                                 detail::key_of_first<std::pair<K, V>>,
+                                 Compare, Mode>;
+
+public:
+  using mapped_type = V;
+  using typename base::key_type;
+  using typename base::value_type;
+
+  using base::base;
+
+  ref<V, Mode> at(const key_type &key) {
+    detail::lock<shared_read, Mode> container(this->value.lifetime());
+    auto i = this->find(key);
+    if (i == this->value.container.size())
+      throw std::out_of_range("key not found");
+    return {this->value.container[i].second, this->value.element_lifetime()};
+  }
+
+  ref<const V, Mode> at(const key_type &key) const {
+    detail::lock<shared_read, Mode> container(this->value.lifetime());
+    auto i = this->find(key);
+    if (i == this->value.container.size())
+      throw std::out_of_range("key not found");
+    return {this->value.container[i].second, this->value.element_lifetime()};
+  }
+
+  bool insert(const key_type &key, const V &v) { return base::insert({key, v}); }
+  using base::insert;
+
+  // Looks up every key in [first, last) under a single read borrow, and writes
+  // the value, or `missing` if the key is not present, to `out`.
+  template <typename InputIt, typename OutputIt>
+  OutputIt lookup(InputIt first, InputIt last, OutputIt out,
+                  const V &missing = V{}) const {
+    return base::lookup(first, last, out, [&](auto it, auto end) {
+      return it != end ? it->second : missing;
+    });
+  }
+};
+
+} // namespace safe
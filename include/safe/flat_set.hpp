@@ -0,0 +1,18 @@
+#pragma once
+
+#include "flat_map.hpp"
+
+namespace safe {
+
+// A sorted set stored in a contiguous vector.
+template <typename K, typename Mode = mode, typename Compare = std::less<K>>
+class flat_set
+    : public detail::flat_tree<K, K, detail::key_of_self<K>, Compare, Mode> {
+  using base = detail::flat_tree<K, K, detail::key_of_self<K>, Compare, Mode>;
+
+public:
+  using base::base;
+  using base::contains;
+};
+
+} // namespace safe
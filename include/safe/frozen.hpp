@@ -0,0 +1,90 @@
+#pragma once
+
+#include "container.hpp"
+
+namespace safe {
+
+// An immutable container, created by freeze().
+// Since the elements can never change, reads do not need to count readers.
+// Instead, each view counts once, and destroying a frozen container whilst
+// it has live views terminates the program. Element access through a view
+// only checks bounds.
+template <typename C, typename Mode> class frozen {
+public:
+  using container_type = C;
+  using value_type = typename C::value_type;
+  using size_type = typename C::size_type;
+  using const_iterator = typename C::const_iterator;
+  using checks = detail::iterator_checks<C, Mode>;
+
+  // A borrow of a frozen container. The references returned by the view
+  // are valid whilst the view is live.
+  class view_type {
+  public:
+    size_type size() const { return value->size(); }
+    bool empty() const { return value->empty(); }
+
+    const value_type &operator[](size_type i) const {
+      checks::check_size(*value, i);
+      return (*value)[i];
+    }
+
+    const value_type &at(size_type i) const { return value->at(i); }
+
+    const value_type &front() const {
+      if (value->empty())
+        throw std::out_of_range("empty container");
+      return value->front();
+    }
+
+    const value_type &back() const {
+      if (value->empty())
+        throw std::out_of_range("empty container");
+      return value->back();
+    }
+
+    const_iterator begin() const { return value->begin(); }
+    const_iterator end() const { return value->end(); }
+
+  private:
+    friend class frozen;
+
+    view_type(const C &value, typename detail::lifetime<Mode>::reference life)
+        : value(&value), lock(life) {}
+
+    const C *value;
+    [[no_unique_address]] detail::optional_lock<shared_read, Mode> lock;
+  };
+
+  // Moves the elements out of the container.
+  // Throws invalid_write if the container or any element is borrowed.
+  explicit frozen(container<C, Mode> &&src)
+      : value(take(src.value)) {}
+
+  frozen(const frozen &other) : value(other.value) {}
+  frozen &operator=(const frozen &) = delete;
+
+  size_type size() const { return value.size(); }
+  bool empty() const { return value.empty(); }
+
+  view_type view() const { return {value, views.get_lifetime()}; }
+
+private:
+  static C take(detail::container_impl<C, Mode> &src) {
+    detail::lock<exclusive_write, Mode> container_lock(src.lifetime()),
+        element_lock(src.element_lifetime());
+    return std::move(src.container);
+  }
+
+  const C value;
+  mutable detail::lifetime<Mode> views;
+};
+
+// Converts a container into an immutable frozen container.
+// Throws invalid_write if the container or any element is borrowed.
+template <typename C, typename Mode>
+frozen<C, Mode> freeze(container<C, Mode> &&src) {
+  return frozen<C, Mode>(std::move(src));
+}
+
+} // namespace safe
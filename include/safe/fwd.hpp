@@ -7,4 +7,7 @@ namespace safe
     template<typename T, typename Mode = mode> class ref;
     template<typename T, typename Mode = mode> class ptr;
     template<typename T, typename Mode = mode> class container;
+    template<typename T, typename Mode = mode> class pool;
+    template<typename Mode = mode> class basic_string_view;
+    template<typename C, typename Mode = mode> class frozen;
 }
@@ -0,0 +1,202 @@
+#pragma once
+
+#include "container.hpp"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <memory>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace safe {
+
+// A byte buffer with explicit capacity that can lend its storage to system
+// calls without copying.
+//
+// prepare() lends a write window over the unused capacity, for read(),
+// pread() or readv(), and the window commits the bytes that were read.
+// data() borrows the committed bytes for write() or writev(). Operations that
+// move or free the storage (reserve(), compact(), clear()) throw
+// invalid_write whilst a window or view is live, and consume() throws
+// invalid_write whilst a view is live.
+template <typename Mode = mode> class basic_io_buffer {
+public:
+  using size_type = std::size_t;
+
+  // Unused capacity that is lent out for writing.
+  // There can only be one window at a time.
+  class window_type {
+  public:
+    char *data() const { return buffer.storage.get() + buffer.end; }
+    size_type size() const { return limit - buffer.end; }
+
+    iovec iov() const { return {data(), size()}; }
+
+    // Appends the first n bytes of the window to the committed bytes
+    void commit(size_type n) {
+      if (n > size())
+        throw std::out_of_range("commit exceeds window");
+      buffer.end += n;
+    }
+
+  private:
+    friend class basic_io_buffer;
+
+    window_type(basic_io_buffer &buffer, size_type n)
+        : buffer(buffer), limit(buffer.end + n),
+          lock(buffer.window_access.get_lifetime()) {}
+
+    basic_io_buffer &buffer;
+    size_type limit;
+    detail::lock<exclusive_write, Mode> lock;
+  };
+
+  // A read borrow of committed bytes
+  class view_type {
+  public:
+    const char *data() const { return items; }
+    size_type size() const { return length; }
+    bool empty() const { return length == 0; }
+
+    char operator[](size_type i) const {
+      detail::index_checks<Mode>::check_size(length, i);
+      return items[i];
+    }
+
+    const char *begin() const { return items; }
+    const char *end() const { return items + length; }
+
+    iovec iov() const { return {const_cast<char *>(items), length}; }
+
+  private:
+    friend class basic_io_buffer;
+
+    view_type(const char *items, size_type length,
+              typename detail::lifetime<Mode>::reference life)
+        : items(items), length(length), lock(life) {}
+
+    const char *items;
+    size_type length;
+    detail::optional_lock<shared_read, Mode> lock;
+  };
+
+  explicit basic_io_buffer(size_type capacity)
+      : storage(std::make_unique<char[]>(capacity)), cap(capacity) {}
+
+  basic_io_buffer(const basic_io_buffer &) = delete;
+  basic_io_buffer &operator=(const basic_io_buffer &) = delete;
+
+  size_type capacity() const { return cap; }
+
+  // The number of committed bytes
+  size_type size() const { return end - begin; }
+  bool empty() const { return end == begin; }
+
+  // The unused capacity after the committed bytes
+  size_type available() const { return cap - end; }
+
+  window_type prepare() { return {*this, available()}; }
+
+  window_type prepare(size_type n) {
+    if (n > available())
+      throw std::out_of_range("not enough capacity");
+    return {*this, n};
+  }
+
+  view_type data() const {
+    return {storage.get() + begin, end - begin, data_access.get_lifetime()};
+  }
+
+  // Removes the first n committed bytes
+  void consume(size_type n) {
+    detail::lock<exclusive_write, Mode> lock(data_access.get_lifetime());
+    if (n > end - begin)
+      throw std::out_of_range("consume exceeds size");
+    begin += n;
+  }
+
+  // Moves the committed bytes to the start of the storage
+  void compact() {
+    detail::lock<exclusive_write, Mode> lock1(data_access.get_lifetime()),
+        lock2(window_access.get_lifetime());
+    std::memmove(storage.get(), storage.get() + begin, end - begin);
+    end -= begin;
+    begin = 0;
+  }
+
+  void reserve(size_type new_capacity) {
+    detail::lock<exclusive_write, Mode> lock1(data_access.get_lifetime()),
+        lock2(window_access.get_lifetime());
+    if (new_capacity <= cap)
+      return;
+    auto new_storage = std::make_unique<char[]>(new_capacity);
+    std::memcpy(new_storage.get(), storage.get() + begin, end - begin);
+    storage = std::move(new_storage);
+    cap = new_capacity;
+    end -= begin;
+    begin = 0;
+  }
+
+  void clear() {
+    detail::lock<exclusive_write, Mode> lock1(data_access.get_lifetime()),
+        lock2(window_access.get_lifetime());
+    begin = end = 0;
+  }
+
+  // Reads from fd into the unused capacity and commits the bytes read.
+  // Returns the result of ::read().
+  ssize_t read_from(int fd) {
+    auto w = prepare();
+    auto n = ::read(fd, w.data(), w.size());
+    if (n > 0)
+      w.commit(n);
+    return n;
+  }
+
+  // Writes the committed bytes to fd and consumes the bytes written.
+  // Returns the result of ::write().
+  ssize_t write_to(int fd) {
+    ssize_t n;
+    {
+      auto v = data();
+      n = ::write(fd, v.data(), v.size());
+    }
+    if (n > 0)
+      consume(n);
+    return n;
+  }
+
+private:
+  std::unique_ptr<char[]> storage;
+  size_type cap, begin = 0, end = 0;
+  mutable detail::lifetime<Mode> data_access, window_access;
+};
+
+using io_buffer = basic_io_buffer<mode>;
+
+// Scatter read into several windows, committing the bytes read to each window
+// in turn. Returns the result of ::readv().
+template <typename... Windows> ssize_t readv(int fd, Windows &...windows) {
+  std::array<iovec, sizeof...(Windows)> iov = {windows.iov()...};
+  auto n = ::readv(fd, iov.data(), iov.size());
+  if (n > 0) {
+    std::size_t remaining = n;
+    (
+        [&](auto &w) {
+          auto k = std::min(remaining, w.size());
+          w.commit(k);
+          remaining -= k;
+        }(windows),
+        ...);
+  }
+  return n;
+}
+
+// Gather write from several views. Returns the result of ::writev().
+template <typename... Views> ssize_t writev(int fd, const Views &...views) {
+  std::array<iovec, sizeof...(Views)> iov = {views.iov()...};
+  return ::writev(fd, iov.data(), iov.size());
+}
+
+} // namespace safe
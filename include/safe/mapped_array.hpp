@@ -0,0 +1,158 @@
+#pragma once
+
+#include "container.hpp"
+#include <cerrno>
+#include <span>
+#include <string>
+#include <system_error>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace safe {
+
+// A read-only array of T that maps a file into memory, so that large tables
+// can be used without reading them in, and pages are shared between
+// processes. Elements and spans are borrowed from the mapping, and unmapping
+// the file whilst it is borrowed throws invalid_write (or terminates the
+// program in the destructor), just like destroying a value.
+template <typename T, typename Mode = mode> class mapped_array {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "mapped_array requires a trivially copyable type");
+
+public:
+  using value_type = T;
+  using size_type = std::size_t;
+  using checks = detail::index_checks<Mode>;
+
+  // A borrowed range of the mapping
+  class span_type {
+  public:
+    size_type size() const { return items.size(); }
+    bool empty() const { return items.empty(); }
+
+    const T &operator[](size_type i) const {
+      checks::check_size(items.size(), i);
+      return items[i];
+    }
+
+    const T &at(size_type i) const {
+      if (i >= items.size())
+        throw std::out_of_range("out of range");
+      return items[i];
+    }
+
+    const T *begin() const { return items.data(); }
+    const T *end() const { return items.data() + items.size(); }
+
+    // The subspan shares the borrow of this span
+    span_type subspan(size_type offset, size_type count) const {
+      if (offset > items.size() || count > items.size() - offset)
+        throw std::out_of_range("out of range");
+      span_type result = *this;
+      result.items = items.subspan(offset, count);
+      return result;
+    }
+
+  private:
+    friend class mapped_array;
+
+    span_type(std::span<const T> items,
+              typename detail::lifetime<Mode>::reference life)
+        : items(items), lock(life) {}
+
+    std::span<const T> items;
+    [[no_unique_address]] detail::optional_lock<shared_read, Mode> lock;
+  };
+
+  // Maps the whole file, whose size must be a multiple of sizeof(T).
+  // Throws std::system_error if the file cannot be mapped.
+  explicit mapped_array(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::system_error(errno, std::generic_category(), path);
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      auto error = errno;
+      ::close(fd);
+      throw std::system_error(error, std::generic_category(), path);
+    }
+    bytes = st.st_size;
+    if (bytes % sizeof(T) != 0) {
+      ::close(fd);
+      throw std::system_error(std::make_error_code(std::errc::invalid_argument),
+                              path);
+    }
+    if (bytes > 0) {
+      auto p = ::mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+      if (p == MAP_FAILED) {
+        auto error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), path);
+      }
+      items = static_cast<const T *>(p);
+    }
+    ::close(fd);
+  }
+
+  mapped_array(mapped_array &&other) {
+    detail::lock<exclusive_write, Mode> lock(other.life.get_lifetime());
+    std::swap(items, other.items);
+    std::swap(bytes, other.bytes);
+  }
+
+  mapped_array(const mapped_array &) = delete;
+  mapped_array &operator=(const mapped_array &) = delete;
+
+  ~mapped_array() {
+    // Check before unmapping, since borrows would then be dangling
+    life.terminate_if_live();
+    release();
+  }
+
+  size_type size() const { return bytes / sizeof(T); }
+  bool empty() const { return bytes == 0; }
+  bool is_mapped() const { return items != nullptr; }
+
+  ref<const T, Mode> operator[](size_type i) const {
+    checks::check_size(size(), i);
+    return {items[i], life.get_lifetime()};
+  }
+
+  ref<const T, Mode> at(size_type i) const {
+    if (i >= size())
+      throw std::out_of_range("out of range");
+    return {items[i], life.get_lifetime()};
+  }
+
+  span_type span() const { return {{items, size()}, life.get_lifetime()}; }
+
+  span_type span(size_type offset, size_type count) const {
+    if (offset > size() || count > size() - offset)
+      throw std::out_of_range("out of range");
+    return {{items + offset, count}, life.get_lifetime()};
+  }
+
+  // Throws invalid_write if any element is borrowed
+  void unmap() {
+    detail::lock<exclusive_write, Mode> lock(life.get_lifetime());
+    release();
+  }
+
+private:
+  void release() {
+    if (items)
+      ::munmap(const_cast<T *>(items), bytes);
+    items = nullptr;
+    bytes = 0;
+  }
+
+  const T *items = nullptr;
+  size_type bytes = 0;
+  mutable detail::lifetime<Mode> life;
+};
+
+} // namespace safe
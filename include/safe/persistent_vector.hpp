@@ -0,0 +1,246 @@
+#pragma once
+
+#include "container.hpp"
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace safe {
+
+namespace detail {
+
+// A 32-way trie of shared nodes. Copying the trie shares all of its nodes,
+// and modifying it copies the path to the modified element (path copying).
+// Nodes that are only referenced by this trie are modified in place.
+template <typename T> class persistent_trie {
+  static constexpr unsigned bits = 5;
+  static constexpr std::size_t width = std::size_t(1) << bits,
+                               mask = width - 1;
+
+  struct node {
+    std::vector<std::shared_ptr<node>> children; // Inner nodes only
+    std::vector<T> values;                       // Leaves only
+  };
+
+public:
+  using size_type = std::size_t;
+
+  size_type size() const { return count; }
+
+  const T &get(size_type i) const {
+    auto n = root.get();
+    for (auto s = shift; s > 0; s -= bits)
+      n = n->children[(i >> s) & mask].get();
+    return n->values[i & mask];
+  }
+
+  // Copies the path to element i if it is shared
+  T &get_mutable(size_type i) {
+    auto n = unique(root);
+    for (auto s = shift; s > 0; s -= bits)
+      n = unique(n->children[(i >> s) & mask]);
+    return n->values[i & mask];
+  }
+
+  template <typename... Args> void emplace_back(Args &&...args) {
+    if (!root) {
+      root = std::make_shared<node>();
+    } else if (count == width << shift) {
+      // The trie is full, so add a level
+      auto new_root = std::make_shared<node>();
+      new_root->children.push_back(std::move(root));
+      root = std::move(new_root);
+      shift += bits;
+    }
+    auto n = unique(root);
+    for (auto s = shift; s > 0; s -= bits) {
+      auto index = (count >> s) & mask;
+      if (index == n->children.size())
+        n->children.push_back(std::make_shared<node>());
+      n = unique(n->children[index]);
+    }
+    n->values.emplace_back(std::forward<Args>(args)...);
+    ++count;
+  }
+
+  void pop_back() {
+    if (pop(root, shift)) {
+      root.reset();
+      shift = 0;
+    } else {
+      while (shift > 0 && root->children.size() == 1) {
+        root = root->children.front();
+        shift -= bits;
+      }
+    }
+    --count;
+  }
+
+  void clear() {
+    root.reset();
+    shift = 0;
+    count = 0;
+  }
+
+private:
+  static node *unique(std::shared_ptr<node> &n) {
+    if (n.use_count() > 1)
+      n = std::make_shared<node>(*n);
+    else
+      // Synchronize with other versions that released this node
+      std::atomic_thread_fence(std::memory_order_acquire);
+    return n.get();
+  }
+
+  // Returns true if the node is now empty
+  static bool pop(std::shared_ptr<node> &n, unsigned shift) {
+    auto u = unique(n);
+    if (shift == 0) {
+      u->values.pop_back();
+      return u->values.empty();
+    }
+    if (pop(u->children.back(), shift - bits))
+      u->children.pop_back();
+    return u->children.empty();
+  }
+
+  std::shared_ptr<node> root;
+  unsigned shift = 0;
+  size_type count = 0;
+};
+
+} // namespace detail
+
+// A vector with structural sharing, so that taking a snapshot is O(1).
+// Writes copy the path to the modified element if it is shared with a
+// snapshot. Snapshots are immutable and can be read from any thread without
+// interacting with the borrows of the vector.
+template <typename T, typename Mode = mode> class persistent_vector {
+  using trie_type = detail::persistent_trie<T>;
+
+public:
+  using value_type = T;
+  using size_type = std::size_t;
+  using checks = detail::index_checks<Mode>;
+
+  // An immutable version of a persistent_vector.
+  // Copying a snapshot is O(1) and each copy has its own borrows.
+  class snapshot_type {
+  public:
+    snapshot_type() {}
+    snapshot_type(const snapshot_type &other) : trie(other.trie) {}
+
+    snapshot_type &operator=(const snapshot_type &other) {
+      detail::lock<exclusive_write, Mode> lock(life.get_lifetime());
+      trie = other.trie;
+      return *this;
+    }
+
+    size_type size() const { return trie.size(); }
+    bool empty() const { return trie.size() == 0; }
+
+    ref<const T, Mode> operator[](size_type i) const {
+      checks::check_size(trie.size(), i);
+      return {trie.get(i), life.get_lifetime()};
+    }
+
+    ref<const T, Mode> at(size_type i) const {
+      if (i >= trie.size())
+        throw std::out_of_range("out of range");
+      return {trie.get(i), life.get_lifetime()};
+    }
+
+  private:
+    friend class persistent_vector;
+    snapshot_type(const trie_type &trie) : trie(trie) {}
+
+    trie_type trie;
+    mutable detail::lifetime<Mode> life;
+  };
+
+  persistent_vector() {}
+
+  persistent_vector(std::initializer_list<T> il) {
+    for (auto &v : il)
+      trie.emplace_back(v);
+  }
+
+  persistent_vector(const snapshot_type &s) : trie(s.trie) {}
+
+  // Copying shares the elements
+  persistent_vector(const persistent_vector &other) : trie(other.read_trie()) {}
+
+  persistent_vector &operator=(const persistent_vector &other) {
+    if (this != &other) {
+      auto t = other.read_trie();
+      detail::lock<exclusive_write, Mode> lock(life.get_lifetime());
+      trie = std::move(t);
+    }
+    return *this;
+  }
+
+  size_type size() const { return trie.size(); }
+  bool empty() const { return trie.size() == 0; }
+
+  // O(1). Throws invalid_read if an element is borrowed for writing.
+  snapshot_type snapshot() const { return read_trie(); }
+
+  ref<const T, Mode> read(size_type i) const {
+    checks::check_size(trie.size(), i);
+    return {trie.get(i), life.get_lifetime()};
+  }
+
+  ref<const T, Mode> operator[](size_type i) const { return read(i); }
+
+  ref<const T, Mode> at(size_type i) const {
+    if (i >= trie.size())
+      throw std::out_of_range("out of range");
+    return read(i);
+  }
+
+  // Copies the path to the element if it is shared with a snapshot
+  ref<T, Mode> write(size_type i) {
+    checks::check_size(trie.size(), i);
+    detail::lock<exclusive_write, Mode> lock(life.get_lifetime());
+    // The ref takes over the borrow before the lock releases it, so no
+    // snapshot can share the copied path in between
+    return {trie.get_mutable(i), life.get_lifetime(), detail::move_tag{}};
+  }
+
+  template <typename U> void set(size_type i, U &&value) {
+    checks::check_size(trie.size(), i);
+    detail::lock<exclusive_write, Mode> lock(life.get_lifetime());
+    trie.get_mutable(i) = std::forward<U>(value);
+  }
+
+  template <typename... Args> void emplace_back(Args &&...args) {
+    detail::lock<exclusive_write, Mode> lock(life.get_lifetime());
+    trie.emplace_back(std::forward<Args>(args)...);
+  }
+
+  void push_back(const T &value) { emplace_back(value); }
+  void push_back(T &&value) { emplace_back(std::move(value)); }
+
+  void pop_back() {
+    if (trie.size() == 0)
+      throw std::out_of_range("empty vector");
+    detail::lock<exclusive_write, Mode> lock(life.get_lifetime());
+    trie.pop_back();
+  }
+
+  void clear() {
+    detail::lock<exclusive_write, Mode> lock(life.get_lifetime());
+    trie.clear();
+  }
+
+private:
+  trie_type read_trie() const {
+    detail::lock<shared_read, Mode> lock(life.get_lifetime());
+    return trie;
+  }
+
+  trie_type trie;
+  mutable detail::lifetime<Mode> life;
+};
+
+} // namespace safe
@@ -0,0 +1,167 @@
+#pragma once
+
+#include "value.hpp"
+#include <memory>
+#include <vector>
+
+namespace safe {
+
+namespace detail {
+
+// The lifetime record of a pool slot.
+// In checked mode this is a heap record that pointers share, as in weak mode.
+// A released slot keeps its record if no pointers to it remain, so that a
+// steady state of make()/release() does not allocate.
+template <typename Mode> class pool_lifetime {
+public:
+  lifetime<unchecked>::reference acquire() { return {}; }
+  void release() {}
+  void destroy() {}
+  bool owns(const optional_lifetime_ptr<unchecked> &) const { return true; }
+};
+
+template <> class pool_lifetime<checked> {
+public:
+  pool_lifetime() : life(nullptr) {}
+  pool_lifetime(const pool_lifetime &) = delete;
+  ~pool_lifetime() { retire(); }
+
+  lifetime<checked> &acquire() {
+    if (life && life->weak_count == 1) {
+      life->is_live = 1;
+    } else {
+      retire();
+      life = new lifetime<checked>;
+    }
+    return *life;
+  }
+
+  // Throws if the object is borrowed, and expires all pointers to it
+  void release() {
+    lock<exclusive_write, checked> check(*life);
+    life->is_live = 0;
+  }
+
+  // Terminates if the object is borrowed, and expires all pointers to it
+  void destroy() {
+    life->terminate_if_live();
+    life->is_live = 0;
+  }
+
+  bool owns(const optional_lifetime_ptr<checked> &p) const {
+    return p.is_live() && &p.lifetime() == life;
+  }
+
+private:
+  void retire() {
+    if (life && !--life->weak_count)
+      delete life;
+    life = nullptr;
+  }
+
+  lifetime<checked> *life;
+};
+
+} // namespace detail
+
+// Allocates objects from slabs of recycled storage, and hands out ptr<T>.
+// Releasing an object expires all pointers to it, so use after release throws
+// expired_pointer even once the slot has been reused. A pool is not
+// thread-safe.
+template <typename T, typename Mode> class pool {
+  struct slot {
+    alignas(T) unsigned char storage[sizeof(T)];
+    detail::pool_lifetime<Mode> life;
+    slot *next_free = nullptr;
+    bool live = false;
+
+    T &get() { return *std::launder(reinterpret_cast<T *>(storage)); }
+  };
+
+public:
+  using value_type = T;
+  using size_type = std::size_t;
+  using pointer = ptr<T, Mode>;
+
+  static constexpr size_type first_slab_size = 16;
+
+  pool() : free_list(nullptr), count(0) {}
+  pool(const pool &) = delete;
+  pool &operator=(const pool &) = delete;
+
+  ~pool() {
+    for (size_type s = 0; s < slabs.size(); ++s) {
+      for (size_type i = 0; i < slab_size(s); ++i) {
+        auto &sl = slabs[s][i];
+        if (sl.live) {
+          sl.life.destroy();
+          std::destroy_at(&sl.get());
+        }
+      }
+    }
+  }
+
+  template <typename... Args> pointer make(Args &&...args) {
+    if (!free_list)
+      grow();
+    auto s = free_list;
+    std::construct_at(&s->get(), std::forward<Args>(args)...);
+    free_list = s->next_free;
+    s->live = true;
+    ++count;
+    return {s->get(), s->life.acquire()};
+  }
+
+  // Destroys the object and recycles its storage. Throws invalid_write if the
+  // object is borrowed, and expired_pointer if it was already released.
+  void release(const pointer &p) {
+    if (!p.value)
+      throw null_pointer();
+    auto s = find(p.value);
+    if (!s || !s->live || !s->life.owns(p.life))
+      throw expired_pointer();
+    s->life.release();
+    std::destroy_at(&s->get());
+    s->live = false;
+    s->next_free = free_list;
+    free_list = s;
+    --count;
+  }
+
+  size_type size() const { return count; }
+
+  size_type capacity() const {
+    return slabs.empty() ? 0 : slab_size(slabs.size()) - first_slab_size;
+  }
+
+private:
+  // Each slab is twice the size of the previous one
+  static size_type slab_size(size_type s) { return first_slab_size << s; }
+
+  void grow() {
+    auto n = slab_size(slabs.size());
+    auto &slab = slabs.emplace_back(new slot[n]);
+    for (size_type i = n; i-- > 0;) {
+      slab[i].next_free = free_list;
+      free_list = &slab[i];
+    }
+  }
+
+  slot *find(const T *p) const {
+    for (size_type s = 0; s < slabs.size(); ++s) {
+      auto first = slabs[s].get(), last = first + slab_size(s);
+      if (std::less_equal<const void *>()(first, p) &&
+          std::less<const void *>()(p, last))
+        return first + (reinterpret_cast<const unsigned char *>(p) -
+                        reinterpret_cast<const unsigned char *>(first)) /
+                           sizeof(slot);
+    }
+    return nullptr;
+  }
+
+  std::vector<std::unique_ptr<slot[]>> slabs;
+  slot *free_list;
+  size_type count;
+};
+
+} // namespace safe
@@ -30,6 +30,7 @@ public:
 
 private:
   template <typename U, typename M> friend class ptr;
+  template <typename U, typename M> friend class pool;
   T *value;
   detail::optional_lifetime_ptr<Mode> life;
 };
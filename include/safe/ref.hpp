@@ -48,6 +48,12 @@ public:
 
   ref(ref &&src) : value(src.value), life(src.lifetime(), detail::move_tag{}) {}
 
+  // Takes over a write borrow that the caller already holds, so that there is
+  // no gap between checking the value and returning the ref
+  ref(value_type &value, typename lifetime_type::reference life,
+      detail::move_tag)
+      : value(value), life(life, detail::move_tag{}) {}
+
   template <typename U>
   ref(const ref<U, Mode> &src) : value(src.value), life(src.lifetime()) {}
 
@@ -0,0 +1,329 @@
+#pragma once
+
+#include "container.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+namespace safe {
+
+// A string for large, frequently edited text.
+// The text is stored in chunks held in a balanced tree (a treap ordered by
+// position), so inserting and erasing take O(log n) time. Each chunk has its
+// own lifetime, so edits only check the borrows of the chunks they modify, and
+// readers of other chunks keep their borrows across edits.
+template <typename Mode = mode> class rope {
+  struct node {
+    explicit node(std::string text, std::uint32_t priority)
+        : text(std::move(text)), priority(priority) {}
+
+    std::string text;
+    // Declared after the text so that borrows are checked first
+    mutable detail::lifetime<Mode> life;
+    std::uint32_t priority;
+    std::size_t total = 0, count = 0; // Length and number of chunks
+    std::unique_ptr<node> left, right;
+  };
+
+  using node_ptr = std::unique_ptr<node>;
+
+public:
+  using size_type = std::size_t;
+
+  static constexpr size_type max_chunk = 1024;
+
+  // A borrowed range of the rope. Holding a slice borrows the chunks that it
+  // covers, so they cannot be modified, but the rest of the rope can be.
+  class slice {
+  public:
+    size_type size() const { return length; }
+
+    char operator[](size_type i) const {
+      detail::index_checks<Mode>::check_size(length, i);
+      for (auto &p : pieces) {
+        if (i < p.length)
+          return (*p.chunk)[p.offset + i];
+        i -= p.length;
+      }
+      return 0;
+    }
+
+    // Copies the characters
+    std::string str() const {
+      std::string result;
+      result.reserve(length);
+      for (auto &p : pieces)
+        result.append(*p.chunk, p.offset, p.length);
+      return result;
+    }
+
+    bool operator==(std::string_view s) const {
+      if (s.size() != length)
+        return false;
+      for (auto &p : pieces) {
+        if (std::string_view(*p.chunk).substr(p.offset, p.length) !=
+            s.substr(0, p.length))
+          return false;
+        s.remove_prefix(p.length);
+      }
+      return true;
+    }
+
+  private:
+    friend class rope;
+
+    struct piece {
+      ref<const std::string, Mode> chunk;
+      size_type offset, length;
+    };
+
+    std::vector<piece> pieces;
+    size_type length = 0;
+  };
+
+  rope() : seed(0x9e3779b9) {}
+
+  rope(std::string_view text) : rope() { insert(0, text); }
+  rope(const char *text) : rope(std::string_view(text)) {}
+
+  rope(const rope &) = delete;
+  rope &operator=(const rope &) = delete;
+
+  size_type size() const { return root ? root->total : 0; }
+  bool empty() const { return size() == 0; }
+  size_type chunk_count() const { return root ? root->count : 0; }
+
+  // Inserting at a chunk boundary does not modify borrowed chunks.
+  // Throws invalid_write if the insertion is inside a borrowed chunk.
+  void insert(size_type pos, std::string_view text) {
+    detail::lock<exclusive_write, Mode> lock(structure.get_lifetime());
+    if (pos > size())
+      throw std::out_of_range("out of range");
+    if (text.empty())
+      return;
+    if (!root) {
+      root = make_chunks(text);
+      return;
+    }
+
+    auto [index, offset] = locate(pos);
+    auto [left, rest] = split(std::move(root), index);
+    auto [chunk, right] = split(std::move(rest), 1);
+
+    auto length = chunk->text.size();
+    bool boundary = offset == 0 || offset == length;
+    if (boundary && (borrowed(*chunk) || length + text.size() > max_chunk)) {
+      // Add new chunks before or after the existing chunk
+      auto inserted = make_chunks(text);
+      if (offset == 0)
+        chunk = merge(std::move(inserted), std::move(chunk));
+      else
+        chunk = merge(std::move(chunk), std::move(inserted));
+    } else {
+      try {
+        detail::lock<exclusive_write, Mode> write(chunk->life.get_lifetime());
+        chunk->text.insert(offset, text);
+      } catch (...) {
+        root = merge(merge(std::move(left), std::move(chunk)), std::move(right));
+        throw;
+      }
+      if (chunk->text.size() > max_chunk)
+        chunk = make_chunks(chunk->text);
+      else
+        update(chunk.get());
+    }
+    root = merge(merge(std::move(left), std::move(chunk)), std::move(right));
+  }
+
+  // Throws invalid_write if any of the erased characters are borrowed
+  void erase(size_type pos, size_type n) {
+    detail::lock<exclusive_write, Mode> lock(structure.get_lifetime());
+    if (pos > size())
+      throw std::out_of_range("out of range");
+    n = std::min(n, size() - pos);
+
+    // Check every chunk before erasing from any of them, so that a failed
+    // erase leaves the rope unchanged
+    for (size_type p = pos; p < pos + n;) {
+      auto [chunk, offset] = find(p);
+      if (borrowed(*chunk))
+        throw invalid_write();
+      p += chunk->text.size() - offset;
+    }
+
+    while (n > 0) {
+      auto [index, offset] = locate(pos);
+      auto [left, rest] = split(std::move(root), index);
+      auto [chunk, right] = split(std::move(rest), 1);
+      if (offset == chunk->text.size()) {
+        // pos is at the end of this chunk, so erase from the next one
+        left = merge(std::move(left), std::move(chunk));
+        std::tie(chunk, right) = split(std::move(right), 1);
+        offset = 0;
+      }
+      auto k = std::min(n, chunk->text.size() - offset);
+      try {
+        detail::lock<exclusive_write, Mode> write(chunk->life.get_lifetime());
+        chunk->text.erase(offset, k);
+      } catch (...) {
+        root = merge(merge(std::move(left), std::move(chunk)), std::move(right));
+        throw;
+      }
+      if (chunk->text.empty())
+        chunk.reset();
+      else
+        update(chunk.get());
+      root = merge(merge(std::move(left), std::move(chunk)), std::move(right));
+      n -= k;
+    }
+  }
+
+  void append(std::string_view text) { insert(size(), text); }
+
+  // Borrows the chunks covering [pos, pos+n) for reading
+  slice read(size_type pos, size_type n) const {
+    detail::lock<shared_read, Mode> lock(structure.get_lifetime());
+    if (pos > size())
+      throw std::out_of_range("out of range");
+    n = std::min(n, size() - pos);
+    slice result;
+    while (n > 0) {
+      auto [chunk, offset] = find(pos);
+      auto k = std::min(n, chunk->text.size() - offset);
+      result.pieces.push_back(
+          {{chunk->text, chunk->life.get_lifetime()}, offset, k});
+      result.length += k;
+      pos += k;
+      n -= k;
+    }
+    return result;
+  }
+
+  char at(size_type pos) const {
+    detail::lock<shared_read, Mode> lock(structure.get_lifetime());
+    if (pos >= size())
+      throw std::out_of_range("out of range");
+    auto [chunk, offset] = find(pos);
+    detail::lock<shared_read, Mode> read(chunk->life.get_lifetime());
+    return chunk->text[offset];
+  }
+
+  // Copies the characters
+  std::string str() const {
+    auto s = read(0, size());
+    return s.str();
+  }
+
+private:
+  static bool borrowed(const node &n) {
+    if constexpr (std::is_same_v<Mode, unchecked>) {
+      return false;
+    } else {
+      auto &life = n.life.get_lifetime();
+      return life.readers || life.writers;
+    }
+  }
+
+  static size_type total(const node_ptr &n) { return n ? n->total : 0; }
+  static size_type count(const node_ptr &n) { return n ? n->count : 0; }
+
+  static void update(node *n) {
+    n->total = total(n->left) + n->text.size() + total(n->right);
+    n->count = count(n->left) + 1 + count(n->right);
+  }
+
+  // Splits into the first k chunks and the rest
+  static std::pair<node_ptr, node_ptr> split(node_ptr n, size_type k) {
+    if (!n)
+      return {};
+    if (count(n->left) >= k) {
+      auto [a, b] = split(std::move(n->left), k);
+      n->left = std::move(b);
+      update(n.get());
+      return {std::move(a), std::move(n)};
+    }
+    auto [a, b] = split(std::move(n->right), k - count(n->left) - 1);
+    n->right = std::move(a);
+    update(n.get());
+    return {std::move(n), std::move(b)};
+  }
+
+  static node_ptr merge(node_ptr a, node_ptr b) {
+    if (!a)
+      return b;
+    if (!b)
+      return a;
+    if (a->priority > b->priority) {
+      a->right = merge(std::move(a->right), std::move(b));
+      update(a.get());
+      return a;
+    }
+    b->left = merge(std::move(a), std::move(b->left));
+    update(b.get());
+    return b;
+  }
+
+  // Returns the chunk index and offset of pos. The last chunk is returned for
+  // the end of the rope.
+  std::pair<size_type, size_type> locate(size_type pos) const {
+    size_type index = 0;
+    auto n = root.get();
+    for (;;) {
+      auto left = total(n->left);
+      if (pos < left || (pos == left && n->left)) {
+        n = n->left.get();
+      } else if (pos - left <= n->text.size() &&
+                 (pos - left < n->text.size() || !n->right)) {
+        return {index + count(n->left), pos - left};
+      } else {
+        pos -= left + n->text.size();
+        index += count(n->left) + 1;
+        n = n->right.get();
+      }
+    }
+  }
+
+  // Returns the chunk containing pos, which must be less than size()
+  std::pair<const node *, size_type> find(size_type pos) const {
+    auto n = root.get();
+    for (;;) {
+      auto left = total(n->left);
+      if (pos < left) {
+        n = n->left.get();
+      } else if (pos - left < n->text.size()) {
+        return {n, pos - left};
+      } else {
+        pos -= left + n->text.size();
+        n = n->right.get();
+      }
+    }
+  }
+
+  node_ptr make_chunks(std::string_view text) {
+    node_ptr result;
+    for (size_type i = 0; i < text.size(); i += max_chunk / 2) {
+      auto n = std::make_unique<node>(
+          std::string(text.substr(i, max_chunk / 2)), next_priority());
+      update(n.get());
+      result = merge(std::move(result), std::move(n));
+    }
+    return result;
+  }
+
+  std::uint32_t next_priority() {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+  }
+
+  std::uint32_t seed;
+  node_ptr root;
+  mutable detail::lifetime<Mode> structure;
+};
+
+} // namespace safe
@@ -0,0 +1,160 @@
+#pragma once
+
+#include "borrow.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace safe {
+
+// Runs tasks on a pool of threads, in parallel unless they conflict.
+// Each task declares the objects that it reads and writes, and is called with
+// a borrow of each one. A task waits for the tasks submitted before it that
+// write an object it uses, or that read an object it writes, so conflicting
+// tasks run in the order they were submitted instead of throwing.
+//
+// The borrows are taken from the objects as usual, so in checked mode a task
+// that uses an object it did not declare, or declares the same object twice,
+// throws invalid_read or invalid_write if it conflicts with another task.
+class scheduler {
+public:
+  explicit scheduler(
+      std::size_t threads = std::max(1u, std::thread::hardware_concurrency())) {
+    for (std::size_t i = 0; i < threads; ++i)
+      workers.emplace_back([this] { work(); });
+  }
+
+  scheduler(const scheduler &) = delete;
+  scheduler &operator=(const scheduler &) = delete;
+
+  // Waits for the tasks to finish. Exceptions from tasks are discarded.
+  ~scheduler() {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      idle.wait(lock, [&] { return outstanding == 0; });
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto &t : workers)
+      t.join();
+  }
+
+  // Schedules f(borrows...), for example
+  //   s.submit([](auto from, auto to) { ... }, safe::reads(a), safe::writes(b));
+  template <typename F, typename... T, bool... Write>
+  void submit(F f, detail::access<T, Write>... access) {
+    auto t = std::make_shared<node>();
+    t->run = [f = std::move(f), access...]() mutable {
+      f(access.acquire()...);
+    };
+
+    std::lock_guard<std::mutex> lock(mutex);
+    (depend(t, access.address(), Write), ...);
+    ++outstanding;
+    if (t->waiting == 0)
+      push(t);
+  }
+
+  // Waits for all submitted tasks to finish, and rethrows the first exception
+  // thrown by a task
+  void wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [&] { return outstanding == 0; });
+    objects.clear();
+    if (error)
+      std::rethrow_exception(std::exchange(error, nullptr));
+  }
+
+  std::size_t thread_count() const { return workers.size(); }
+
+private:
+  struct node {
+    std::function<void()> run;
+    std::size_t waiting = 0; // Unfinished tasks that this task waits for
+    bool done = false;
+    std::vector<std::shared_ptr<node>> dependents;
+  };
+
+  // The tasks that use an object: the last writer and the readers after it
+  struct uses {
+    std::shared_ptr<node> writer;
+    std::vector<std::shared_ptr<node>> readers;
+  };
+
+  void depend(const std::shared_ptr<node> &t, const void *object, bool write) {
+    auto &u = objects[object];
+    after(t, u.writer);
+    if (write) {
+      for (auto &r : u.readers)
+        after(t, r);
+      u.readers.clear();
+      u.writer = t;
+    } else {
+      std::erase_if(u.readers, [](auto &r) { return r->done; });
+      u.readers.push_back(t);
+    }
+  }
+
+  void after(const std::shared_ptr<node> &t, const std::shared_ptr<node> &dep) {
+    if (!dep || dep == t || dep->done)
+      return;
+    if (!dep->dependents.empty() && dep->dependents.back() == t)
+      return; // Already waiting for dep
+    dep->dependents.push_back(t);
+    ++t->waiting;
+  }
+
+  void push(std::shared_ptr<node> t) {
+    ready.push_back(std::move(t));
+    wake.notify_one();
+  }
+
+  void work() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+      wake.wait(lock, [&] { return stopping || !ready.empty(); });
+      if (ready.empty())
+        return;
+      auto t = std::move(ready.front());
+      ready.pop_front();
+
+      lock.unlock();
+      std::exception_ptr e;
+      try {
+        t->run();
+      } catch (...) {
+        e = std::current_exception();
+      }
+      t->run = nullptr;
+      lock.lock();
+
+      if (e && !error)
+        error = e;
+      t->done = true;
+      for (auto &d : t->dependents)
+        if (--d->waiting == 0)
+          push(d);
+      t->dependents.clear();
+      if (--outstanding == 0)
+        idle.notify_all();
+    }
+  }
+
+  std::mutex mutex;
+  std::condition_variable wake, idle;
+  std::deque<std::shared_ptr<node>> ready;
+  std::unordered_map<const void *, uses> objects;
+  std::size_t outstanding = 0;
+  std::exception_ptr error;
+  bool stopping = false;
+  std::vector<std::thread> workers;
+};
+
+} // namespace safe
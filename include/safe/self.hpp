@@ -0,0 +1,45 @@
+#pragma once
+
+#include "value.hpp"
+
+namespace safe {
+
+// A base class that embeds the lifetime record in the object itself, so that
+// the object can hand out pointers to itself without being wrapped in a
+// value<T>. This works for objects on the heap, for example owned by a
+// std::unique_ptr.
+//
+// Since the base class is destroyed after the derived class, the check for
+// dangling pointers and references happens after T's destructor has run.
+template <typename T, typename Mode = mode> class enable_safe_from_this {
+public:
+  using mode = typename mode_type<Mode>::type;
+
+  ptr<T, mode> self() { return {static_cast<T &>(*this), life.get_lifetime()}; }
+
+  ptr<const T, mode> self() const {
+    return {static_cast<const T &>(*this), life.get_lifetime()};
+  }
+
+  ref<const T, mode> read() const {
+    return {static_cast<const T &>(*this), life.get_lifetime()};
+  }
+
+  ref<T, mode> write() {
+    return {static_cast<T &>(*this), life.get_lifetime()};
+  }
+
+protected:
+  enable_safe_from_this() {}
+
+  // Copies are different objects, so get their own lifetime
+  enable_safe_from_this(const enable_safe_from_this &) {}
+  enable_safe_from_this &operator=(const enable_safe_from_this &) {
+    return *this;
+  }
+
+private:
+  [[no_unique_address]] mutable detail::lifetime<Mode> life;
+};
+
+} // namespace safe
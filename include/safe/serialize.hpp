@@ -0,0 +1,314 @@
+#pragma once
+
+#include "mapped_array.hpp"
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <optional>
+#include <ranges>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace safe {
+
+// The binary format is a file header followed by records. Every record starts
+// on a 16-byte boundary with an array_header. An array of trivially copyable
+// elements is followed by its bytes, and a list of containers (element_size
+// 0) is followed by a record for each element. The element size, alignment and
+// kind are checked when reading. Numbers are stored in the byte order of the
+// machine.
+namespace binary {
+
+constexpr std::uint32_t version = 2;
+constexpr std::size_t alignment = 16;
+
+struct file_header {
+  char magic[4] = {'S', 'A', 'F', 'E'};
+  std::uint32_t version = binary::version;
+  std::uint64_t reserved = 0;
+};
+
+// What the elements of an array are, so that reading an array as a different
+// type of the same size throws
+enum class element_kind : std::uint16_t {
+  list,
+  signed_integer,
+  unsigned_integer,
+  floating_point,
+  other // Any other trivially copyable type
+};
+
+template <typename T> constexpr element_kind kind_of() {
+  if constexpr (std::is_floating_point_v<T>)
+    return element_kind::floating_point;
+  else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>)
+    return element_kind::signed_integer;
+  else if constexpr (std::is_integral_v<T>)
+    return element_kind::unsigned_integer;
+  else
+    return element_kind::other;
+}
+
+struct array_header {
+  std::uint64_t count;
+  std::uint32_t element_size; // 0 for a list of containers
+  std::uint16_t element_align;
+  element_kind kind;
+};
+
+static_assert(sizeof(file_header) == alignment);
+static_assert(sizeof(array_header) == alignment);
+
+} // namespace binary
+
+namespace detail {
+
+template <typename T> struct is_container : std::false_type {};
+
+template <typename C, typename Mode>
+struct is_container<container<C, Mode>> : std::true_type {};
+
+template <typename T>
+concept bulk_element =
+    std::is_trivially_copyable_v<T> && !is_container<T>::value &&
+    alignof(T) <= binary::alignment;
+
+struct serializer {
+  template <typename C, typename Mode>
+  static const C &elements(const container<C, Mode> &c) {
+    return c.value.container;
+  }
+
+  template <typename C, typename Mode>
+  static C &elements(container<C, Mode> &c) {
+    return c.value.container;
+  }
+};
+
+} // namespace detail
+
+// Writes containers to the binary format.
+// Each call to write() borrows the container for reading once, and arrays of
+// trivially copyable elements in contiguous containers are copied in bulk.
+class binary_writer {
+public:
+  binary_writer() { append(&header, sizeof(header)); }
+
+  template <typename C, typename Mode>
+  binary_writer &write(const container<C, Mode> &c) {
+    [[maybe_unused]] auto r = c.read();
+    write_elements(detail::serializer::elements(c));
+    return *this;
+  }
+
+  const char *data() const { return buffer.data(); }
+  std::size_t size() const { return buffer.size(); }
+
+  // Moves the bytes out of the writer, for example into a binary_reader
+  std::vector<char> release() {
+    auto result = std::move(buffer);
+    buffer.clear();
+    append(&header, sizeof(header));
+    return result;
+  }
+
+  // Throws std::system_error if the file cannot be written
+  void save(const std::string &path) const {
+    std::ofstream file(path, std::ios::binary);
+    file.write(buffer.data(), buffer.size());
+    if (!file)
+      throw std::system_error(std::make_error_code(std::errc::io_error), path);
+  }
+
+private:
+  template <typename C> void write_elements(const C &c) {
+    using T = typename C::value_type;
+    binary::array_header h = {c.size(), 0, 0, binary::element_kind::list};
+    if constexpr (detail::bulk_element<T>) {
+      h.element_size = sizeof(T);
+      h.element_align = alignof(T);
+      h.kind = binary::kind_of<T>();
+      append(&h, sizeof(h));
+      if constexpr (std::ranges::contiguous_range<C>) {
+        append(std::data(c), c.size() * sizeof(T));
+      } else {
+        for (auto &item : c)
+          append(&item, sizeof(T));
+      }
+      buffer.resize((buffer.size() + binary::alignment - 1) &
+                    ~(binary::alignment - 1));
+    } else {
+      static_assert(detail::is_container<T>::value,
+                    "elements must be trivially copyable or containers");
+      append(&h, sizeof(h));
+      for (auto &item : c)
+        write_elements(detail::serializer::elements(item));
+    }
+  }
+
+  void append(const void *p, std::size_t n) {
+    if (n == 0)
+      return;
+    auto old_size = buffer.size();
+    buffer.resize(old_size + n);
+    std::memcpy(buffer.data() + old_size, p, n);
+  }
+
+  static constexpr binary::file_header header = {};
+  std::vector<char> buffer;
+};
+
+// A read-only view of an array in a binary_reader, without copying.
+// The view borrows the reader, so destroying the reader whilst it has live
+// views terminates the program.
+template <typename T, typename Mode = mode> class binary_view {
+public:
+  using value_type = T;
+  using size_type = std::size_t;
+
+  binary_view() : items(nullptr), length(0) {}
+
+  size_type size() const { return length; }
+  bool empty() const { return length == 0; }
+
+  const T &operator[](size_type i) const {
+    detail::index_checks<Mode>::check_size(length, i);
+    return items[i];
+  }
+
+  const T &at(size_type i) const {
+    if (i >= length)
+      throw std::out_of_range("out of range");
+    return items[i];
+  }
+
+  const T *begin() const { return items; }
+  const T *end() const { return items + length; }
+
+  // Copies the characters
+  std::string str() const
+    requires std::is_same_v<T, char>
+  {
+    return {items, length};
+  }
+
+private:
+  template <typename M> friend class binary_reader;
+
+  binary_view(const T *items, size_type length,
+              typename detail::lifetime<Mode>::reference life)
+      : items(items), length(length), lock(life) {}
+
+  const T *items;
+  size_type length;
+  [[no_unique_address]] detail::optional_lock<shared_read, Mode> lock;
+};
+
+// Reads the binary format sequentially, either from bytes owned by the reader
+// or from a mapped file. Arrays are read as views over the bytes, or copied
+// into containers. Throws invalid_format if the bytes do not match what is
+// being read.
+template <typename Mode = mode> class binary_reader {
+public:
+  explicit binary_reader(std::vector<char> bytes) : owned(std::move(bytes)) {
+    start(owned.data(), owned.size());
+  }
+
+  // Borrows the file for the lifetime of the reader
+  explicit binary_reader(const mapped_array<char, Mode> &file)
+      : source(file.span()) {
+    start(source->begin(), source->size());
+  }
+
+  binary_reader(const binary_reader &) = delete;
+  binary_reader &operator=(const binary_reader &) = delete;
+
+  bool at_end() const { return pos == length; }
+
+  // Reads an array of trivially copyable T, without copying
+  template <typename T>
+    requires detail::bulk_element<T>
+  binary_view<T, Mode> read_array() {
+    auto h = read_header({0, sizeof(T), alignof(T), binary::kind_of<T>()});
+    if (h.count > (length - pos) / sizeof(T))
+      throw invalid_format();
+    auto items = reinterpret_cast<const T *>(bytes + pos);
+    skip(h.count * sizeof(T));
+    return {items, h.count, life.get_lifetime()};
+  }
+
+  // Reads the header of a list of containers, and returns the number of
+  // records that follow
+  std::size_t read_list() {
+    return read_header({0, 0, 0, binary::element_kind::list}).count;
+  }
+
+  // Reads into a container, replacing its elements
+  template <typename C, typename Mode2> void read(container<C, Mode2> &c) {
+    [[maybe_unused]] auto w = c.write();
+    read_elements(detail::serializer::elements(c));
+  }
+
+private:
+  void start(const char *data, std::size_t size) {
+    bytes = data;
+    length = size;
+    if (reinterpret_cast<std::uintptr_t>(data) % binary::alignment != 0)
+      throw invalid_format();
+    binary::file_header h;
+    if (size < sizeof(h))
+      throw invalid_format();
+    std::memcpy(&h, data, sizeof(h));
+    if (std::memcmp(h.magic, binary::file_header{}.magic, sizeof(h.magic)) ||
+        h.version != binary::version)
+      throw invalid_format();
+    pos = sizeof(h);
+  }
+
+  // Throws invalid_format unless the elements are as expected
+  binary::array_header read_header(const binary::array_header &expected) {
+    binary::array_header h;
+    if (length - pos < sizeof(h))
+      throw invalid_format();
+    std::memcpy(&h, bytes + pos, sizeof(h));
+    if (h.element_size != expected.element_size ||
+        h.element_align != expected.element_align || h.kind != expected.kind)
+      throw invalid_format();
+    pos += sizeof(h);
+    return h;
+  }
+
+  // Skips n bytes and the padding after them
+  void skip(std::size_t n) {
+    pos += n;
+    pos = std::min(length, (pos + binary::alignment - 1) &
+                               ~(binary::alignment - 1));
+  }
+
+  template <typename C> void read_elements(C &c) {
+    using T = typename C::value_type;
+    c.clear();
+    if constexpr (detail::bulk_element<T>) {
+      auto v = read_array<T>();
+      if constexpr (requires { c.insert(c.end(), v.begin(), v.end()); }) {
+        c.insert(c.end(), v.begin(), v.end());
+      } else {
+        for (auto &item : v)
+          c.push_back(item);
+      }
+    } else {
+      auto n = read_list();
+      for (std::size_t i = 0; i < n; ++i)
+        read_elements(detail::serializer::elements(c.emplace_back()));
+    }
+  }
+
+  std::vector<char> owned;
+  std::optional<typename mapped_array<char, Mode>::span_type> source;
+  const char *bytes;
+  std::size_t length, pos;
+  mutable detail::lifetime<Mode> life;
+};
+
+} // namespace safe
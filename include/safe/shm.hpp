@@ -0,0 +1,409 @@
+#pragma once
+
+#include "value.hpp"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <new>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace safe {
+
+namespace detail {
+
+// The borrows held by one attached process, so that the borrows of a process
+// that died can be released by recover().
+struct shm_process {
+  static constexpr int max_lifetimes = 2;
+
+  std::atomic<pid_t> pid;
+  std::atomic<int> readers[max_lifetimes], writers[max_lifetimes];
+  std::atomic<int> acquiring; // Borrows being acquired or released
+};
+
+struct shm_header {
+  static constexpr std::uint32_t magic_number = 0x53484d31; // "SHM1"
+  static constexpr int max_processes = 64;
+
+  std::atomic<std::uint32_t> magic; // Set once the segment is initialized
+  std::uint64_t size;
+  shm_process processes[max_processes];
+};
+
+static_assert(std::atomic<int>::is_always_lock_free &&
+                  std::atomic<pid_t>::is_always_lock_free,
+              "shared memory requires address-free atomics");
+
+// A mapping of a POSIX shared memory object, and the slot of this process in
+// its header. The payload follows the header.
+class shm_segment {
+public:
+  // Creates a new shared memory object, failing if it already exists
+  shm_segment(const std::string &name, std::size_t payload_size) {
+    int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+      throw std::system_error(errno, std::generic_category(), name);
+    size = sizeof(shm_header) + payload_size;
+    if (::ftruncate(fd, size) != 0) {
+      auto error = errno;
+      ::close(fd);
+      ::shm_unlink(name.c_str());
+      throw std::system_error(error, std::generic_category(), name);
+    }
+    try {
+      map(fd, name);
+    } catch (...) {
+      ::shm_unlink(name.c_str());
+      throw;
+    }
+    header()->size = size;
+  }
+
+  // Opens an existing shared memory object, waiting for it to be initialized
+  explicit shm_segment(const std::string &name) {
+    int fd = ::shm_open(name.c_str(), O_RDWR, 0600);
+    if (fd < 0)
+      throw std::system_error(errno, std::generic_category(), name);
+    struct stat st;
+    while (::fstat(fd, &st) == 0 && st.st_size == 0)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    size = st.st_size;
+    map(fd, name);
+    while (header()->magic.load() != shm_header::magic_number)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  // The mapping does not move, so borrows remain valid
+  shm_segment(shm_segment &&other)
+      : address(other.address), size(other.size), self(other.self) {
+    other.address = nullptr;
+  }
+
+  shm_segment &operator=(const shm_segment &) = delete;
+
+  ~shm_segment() {
+    if (!address)
+      return;
+    for (int i = 0; i < shm_process::max_lifetimes; ++i)
+      if (self->readers[i] || self->writers[i])
+        std::terminate(); // Borrows are still live in this process
+    self->pid = 0;
+    ::munmap(address, size);
+  }
+
+  shm_header *header() const { return static_cast<shm_header *>(address); }
+  void *payload() const { return header() + 1; }
+  std::size_t payload_size() const { return size - sizeof(shm_header); }
+
+  // Called by the creator once the payload is initialized
+  void ready() { header()->magic = shm_header::magic_number; }
+
+  shm_process &process() const { return *self; }
+
+  // Releases the borrows of processes that no longer exist.
+  // Returns the number of borrows released, or -1 if a process died whilst
+  // it held a write borrow, so the payload may be inconsistent, or whilst it
+  // was acquiring or releasing a borrow, so the counters may be wrong.
+  template <int N> int recover(lifetime<checked> *(&lifetimes)[N]) {
+    static_assert(N <= shm_process::max_lifetimes);
+    int released = 0;
+    bool torn = false;
+    for (auto &p : header()->processes) {
+      pid_t pid = p.pid;
+      if (pid == 0 || pid == ::getpid() || alive(pid))
+        continue;
+      for (int i = 0; i < N; ++i) {
+        int r = p.readers[i].exchange(0), w = p.writers[i].exchange(0);
+        lifetimes[i]->readers -= r;
+        lifetimes[i]->writers -= w;
+        released += r + w;
+        torn |= w > 0;
+      }
+      torn |= p.acquiring.exchange(0) > 0;
+      p.pid.compare_exchange_strong(pid, 0);
+    }
+    return torn ? -1 : released;
+  }
+
+private:
+  static bool alive(pid_t pid) { return ::kill(pid, 0) == 0 || errno == EPERM; }
+
+
+  void map(int fd, const std::string &name) {
+    address = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    auto error = errno;
+    ::close(fd);
+    if (address == MAP_FAILED)
+      throw std::system_error(error, std::generic_category(), name);
+
+    // Claim a process slot
+    for (auto &p : header()->processes) {
+      pid_t expected = 0;
+      if (p.pid.compare_exchange_strong(expected, ::getpid())) {
+        self = &p;
+        return;
+      }
+    }
+    ::munmap(address, size);
+    throw std::system_error(std::make_error_code(std::errc::too_many_links),
+                            name);
+  }
+
+  void *address;
+  std::size_t size;
+  shm_process *self;
+};
+
+// A borrow of a lifetime in shared memory, which is also counted in the slot
+// of this process for recovery.
+template <typename Op> class shm_lock {
+public:
+  // The borrow is recorded for this process only whilst it is held, and
+  // acquiring marks the steps in between, so that recover() never releases a
+  // borrow that was not acquired, and reports a process that died part way
+  shm_lock(lifetime<checked> &life, shm_process &process, int index)
+      : life(life), count(counter(process, index)),
+        acquiring(process.acquiring) {
+    ++acquiring;
+    try {
+      Op::acquire(life);
+    } catch (...) {
+      --acquiring;
+      throw;
+    }
+    ++count;
+    --acquiring;
+  }
+
+  shm_lock(const shm_lock &) = delete;
+
+  ~shm_lock() {
+    ++acquiring;
+    --count;
+    Op::release(life);
+    --acquiring;
+  }
+
+private:
+  static std::atomic<int> &counter(shm_process &process, int index) {
+    if constexpr (std::is_same_v<Op, shared_read>)
+      return process.readers[index];
+    else
+      return process.writers[index];
+  }
+
+  lifetime<checked> &life;
+  std::atomic<int> &count, &acquiring;
+};
+
+} // namespace detail
+
+// A borrow of a value in shared memory.
+// shm_ref<const T> is a read borrow and shm_ref<T> is a write borrow.
+template <typename T> class shm_ref {
+  using op = std::conditional_t<std::is_const_v<T>, shared_read, exclusive_write>;
+
+public:
+  shm_ref(T &value, detail::lifetime<checked> &life,
+          detail::shm_process &process, int index)
+      : value(value), lock(life, process, index) {}
+
+  T &operator*() const { return value; }
+  T *operator->() const { return &value; }
+
+private:
+  T &value;
+  detail::shm_lock<op> lock;
+};
+
+// A value in POSIX shared memory that can be borrowed from several processes.
+// The lifetime counters are in the shared memory, so conflicting borrows in
+// different processes throw invalid_read or invalid_write, using the same
+// protocol as value<T>. The checks are always enabled.
+//
+// Destroying a shm_value whilst this process has live borrows terminates the
+// program. If a process dies whilst holding borrows, recover() releases them.
+template <typename T> class shm_value {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "shared memory requires a trivially copyable type");
+
+  struct layout {
+    detail::lifetime<checked> life;
+    T value;
+  };
+
+public:
+  // Creates the shared memory object.
+  // Throws std::system_error if it already exists.
+  template <typename... Args>
+  static shm_value create(const std::string &name, Args &&...args) {
+    shm_value result(detail::shm_segment(name, sizeof(layout)));
+    new (result.segment.payload()) layout{{}, T(std::forward<Args>(args)...)};
+    result.segment.ready();
+    return result;
+  }
+
+  // Opens an existing shared memory object
+  static shm_value open(const std::string &name) {
+    shm_value result(detail::shm_segment{name});
+    if (result.segment.payload_size() != sizeof(layout))
+      throw std::system_error(std::make_error_code(std::errc::invalid_argument),
+                              name);
+    return result;
+  }
+
+  // Removes the name. Processes that have it open can continue to use it.
+  static void remove(const std::string &name) { ::shm_unlink(name.c_str()); }
+
+  shm_ref<const T> read() const {
+    return {data().value, data().life, segment.process(), 0};
+  }
+
+  shm_ref<T> write() {
+    return {data().value, data().life, segment.process(), 0};
+  }
+
+  // Releases the borrows of processes that have died.
+  // Returns the number of borrows released, or -1 if a writer died.
+  int recover() {
+    detail::lifetime<checked> *lifetimes[] = {&data().life};
+    return segment.recover(lifetimes);
+  }
+
+private:
+  explicit shm_value(detail::shm_segment &&segment)
+      : segment(std::move(segment)) {}
+
+  layout &data() const { return *static_cast<layout *>(segment.payload()); }
+
+  detail::shm_segment segment;
+};
+
+// A vector in POSIX shared memory with a fixed capacity.
+// Elements never move, so push_back() is allowed whilst elements are
+// borrowed. Element writers are exclusive, like container, and pop_back()
+// and clear() throw invalid_write whilst any element is borrowed.
+template <typename T> class shm_vector {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "shared memory requires a trivially copyable type");
+
+  struct layout {
+    detail::lifetime<checked> container, elements;
+    std::atomic<std::size_t> count;
+    std::size_t capacity;
+  };
+
+  static constexpr std::size_t items_offset =
+      (sizeof(layout) + alignof(T) - 1) / alignof(T) * alignof(T);
+
+  static constexpr int container_index = 0, element_index = 1;
+
+public:
+  using value_type = T;
+  using size_type = std::size_t;
+
+  // Creates the shared memory object.
+  // Throws std::system_error if it already exists.
+  static shm_vector create(const std::string &name, size_type capacity) {
+    shm_vector result(
+        detail::shm_segment(name, items_offset + capacity * sizeof(T)));
+    auto p = new (result.segment.payload()) layout{};
+    p->capacity = capacity;
+    result.segment.ready();
+    return result;
+  }
+
+  // Opens an existing shared memory object
+  static shm_vector open(const std::string &name) {
+    shm_vector result(detail::shm_segment{name});
+    if (result.segment.payload_size() !=
+        items_offset + result.capacity() * sizeof(T))
+      throw std::system_error(std::make_error_code(std::errc::invalid_argument),
+                              name);
+    return result;
+  }
+
+  static void remove(const std::string &name) { ::shm_unlink(name.c_str()); }
+
+  size_type size() const { return data().count; }
+  size_type capacity() const { return data().capacity; }
+  bool empty() const { return size() == 0; }
+
+  shm_ref<const T> read(size_type i) const {
+    check_size(i);
+    return {items()[i], data().elements, segment.process(), element_index};
+  }
+
+  shm_ref<T> write(size_type i) {
+    check_size(i);
+    return {items()[i], data().elements, segment.process(), element_index};
+  }
+
+  shm_ref<const T> operator[](size_type i) const { return read(i); }
+  shm_ref<T> operator[](size_type i) { return write(i); }
+
+  // Throws std::length_error if the vector is full
+  void push_back(const T &value) {
+    detail::shm_lock<exclusive_write> lock(data().container, segment.process(),
+                                           container_index);
+    auto n = data().count.load();
+    if (n == capacity())
+      throw std::length_error("shm_vector is full");
+    items()[n] = value;
+    data().count = n + 1;
+  }
+
+  void pop_back() {
+    detail::shm_lock<exclusive_write> lock1(
+        data().container, segment.process(), container_index),
+        lock2(data().elements, segment.process(), element_index);
+    if (data().count == 0)
+      throw std::out_of_range("empty vector");
+    --data().count;
+  }
+
+  void clear() {
+    detail::shm_lock<exclusive_write> lock1(
+        data().container, segment.process(), container_index),
+        lock2(data().elements, segment.process(), element_index);
+    data().count = 0;
+  }
+
+  // Releases the borrows of processes that have died.
+  // Returns the number of borrows released, or -1 if a writer died.
+  int recover() {
+    detail::lifetime<checked> *lifetimes[] = {&data().container,
+                                              &data().elements};
+    return segment.recover(lifetimes);
+  }
+
+private:
+  explicit shm_vector(detail::shm_segment &&segment)
+      : segment(std::move(segment)) {}
+
+  layout &data() const { return *static_cast<layout *>(segment.payload()); }
+
+  T *items() const {
+    return reinterpret_cast<T *>(static_cast<char *>(segment.payload()) +
+                                 items_offset);
+  }
+
+  void check_size(size_type i) const {
+    if (i >= size())
+      throw std::out_of_range("out of range");
+  }
+
+  detail::shm_segment segment;
+};
+
+} // namespace safe
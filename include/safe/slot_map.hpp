@@ -0,0 +1,161 @@
+#pragma once
+
+#include "container.hpp"
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace safe {
+
+// A compact reference to an element of a slot_map.
+// Unlike ptr, a handle has no lifetime record, so copying it is free. The
+// generation is checked against the slot when the handle is dereferenced.
+template <typename T> class handle {
+public:
+  handle() = default;
+  handle(std::uint32_t index, std::uint32_t generation)
+      : index(index), generation(generation) {}
+
+  bool operator==(const handle &) const = default;
+  explicit operator bool() const { return generation != 0; }
+
+  std::uint32_t index = 0, generation = 0;
+};
+
+namespace detail {
+template <typename Mode> struct generation_checks {
+  static void check(std::uint32_t expected, std::uint32_t actual) {}
+};
+
+template <> struct generation_checks<checked> {
+  static void check(std::uint32_t expected, std::uint32_t actual) {
+    if (expected == 0)
+      throw null_pointer();
+    if (expected != actual)
+      throw expired_pointer();
+  }
+};
+} // namespace detail
+
+// Stores elements in a dense vector of slots, and hands out handles instead of
+// pointers. Erasing an element increments its slot's generation, so stale
+// handles throw expired_pointer when dereferenced.
+template <typename T, typename Mode = mode> class slot_map {
+  struct slot {
+    std::uint32_t generation = 1, next_free = 0;
+    std::optional<T> value;
+  };
+
+public:
+  using value_type = T;
+  using size_type = std::size_t;
+  using handle_type = handle<T>;
+  using lifetime_type = detail::lifetime<Mode>;
+
+  slot_map() : count(0), free_list(none) {}
+  slot_map(const slot_map &) = delete;
+  slot_map &operator=(const slot_map &) = delete;
+
+  size_type size() const { return count; }
+  bool empty() const { return count == 0; }
+
+  // Reusing a slot does not move other elements, but growing the storage
+  // does, so that throws invalid_write if any element is borrowed.
+  template <typename... Args> handle_type emplace(Args &&...args) {
+    detail::lock<exclusive_write, Mode> lock(container_access.get_lifetime());
+    std::uint32_t i;
+    if (free_list != none) {
+      i = free_list;
+      slots[i].value.emplace(std::forward<Args>(args)...);
+      free_list = slots[i].next_free;
+    } else {
+      if (slots.size() == slots.capacity()) {
+        detail::lock<exclusive_write, Mode> elements(
+            element_access.get_lifetime());
+        slots.reserve(slots.empty() ? 16 : slots.size() * 2);
+      }
+      i = slots.size();
+      slots.emplace_back().value.emplace(std::forward<Args>(args)...);
+    }
+    ++count;
+    return {i, slots[i].generation};
+  }
+
+  handle_type insert(const value_type &v) { return emplace(v); }
+  handle_type insert(value_type &&v) { return emplace(std::move(v)); }
+
+  // Destroys the element, which must not be borrowed.
+  void erase(handle_type h) {
+    detail::lock<exclusive_write, Mode> lock(container_access.get_lifetime());
+    detail::lock<exclusive_write, Mode> elements(element_access.get_lifetime());
+    auto &s = get_slot(h);
+    s.value.reset();
+    // Skip generation 0, which is reserved for null handles
+    if (!++s.generation)
+      ++s.generation;
+    s.next_free = free_list;
+    free_list = h.index;
+    --count;
+  }
+
+  bool contains(handle_type h) const {
+    detail::lock<shared_read, Mode> lock(container_access.get_lifetime());
+    return h.generation && h.index < slots.size() &&
+           slots[h.index].generation == h.generation;
+  }
+
+  ref<value_type, Mode> operator[](handle_type h) {
+    detail::lock<shared_read, Mode> lock(container_access.get_lifetime());
+    return {*get_slot(h).value, element_access.get_lifetime()};
+  }
+
+  ref<const value_type, Mode> operator[](handle_type h) const {
+    detail::lock<shared_read, Mode> lock(container_access.get_lifetime());
+    return {*get_slot(h).value, element_access.get_lifetime()};
+  }
+
+  ref<value_type, Mode> at(handle_type h) { return (*this)[h]; }
+  ref<const value_type, Mode> at(handle_type h) const { return (*this)[h]; }
+
+  void clear() {
+    detail::lock<exclusive_write, Mode> lock(container_access.get_lifetime());
+    detail::lock<exclusive_write, Mode> elements(element_access.get_lifetime());
+    free_list = none;
+    for (std::uint32_t i = 0; i < slots.size(); ++i) {
+      if (slots[i].value) {
+        slots[i].value.reset();
+        if (!++slots[i].generation)
+          ++slots[i].generation;
+      }
+      slots[i].next_free = free_list;
+      free_list = i;
+    }
+    count = 0;
+  }
+
+private:
+  static constexpr std::uint32_t none = -1;
+
+  slot &get_slot(handle_type h) {
+    detail::index_checks<Mode>::check_size(slots.size(), h.index);
+    detail::generation_checks<Mode>::check(h.generation,
+                                           slots[h.index].generation);
+    return slots[h.index];
+  }
+
+  const slot &get_slot(handle_type h) const {
+    detail::index_checks<Mode>::check_size(slots.size(), h.index);
+    detail::generation_checks<Mode>::check(h.generation,
+                                           slots[h.index].generation);
+    return slots[h.index];
+  }
+
+  // Declared first so that the elements are destroyed after the lifetimes
+  // have checked that there are no borrows.
+  std::vector<slot> slots;
+  size_type count;
+  std::uint32_t free_list;
+  mutable detail::lifetime<Mode> container_access, element_access;
+};
+
+} // namespace safe
@@ -0,0 +1,192 @@
+#pragma once
+
+#include "container.hpp"
+#include <memory>
+
+namespace safe {
+
+namespace detail {
+
+// An unchecked vector that stores up to N elements inline, and moves them to
+// the heap when it grows beyond that.
+template <typename T, std::size_t N> class inline_vector {
+  static_assert(N > 0, "use safe::vector for no inline storage");
+
+public:
+  using value_type = T;
+  using size_type = std::size_t;
+  using reference = T &;
+  using const_reference = const T &;
+  using iterator = T *;
+  using const_iterator = const T *;
+
+  inline_vector() : items(inline_data()), count(0), cap(N) {}
+
+  inline_vector(size_type n) : inline_vector() { resize(n); }
+
+  inline_vector(std::initializer_list<T> il) : inline_vector() {
+    reserve(il.size());
+    for (auto &v : il)
+      emplace_back(v);
+  }
+
+  inline_vector(const inline_vector &other) : inline_vector() {
+    reserve(other.size());
+    for (auto &v : other)
+      emplace_back(v);
+  }
+
+  inline_vector(inline_vector &&other) : inline_vector() {
+    if (!other.is_inline()) {
+      items = other.items;
+      count = other.count;
+      cap = other.cap;
+      other.items = other.inline_data();
+      other.count = 0;
+      other.cap = N;
+    } else {
+      for (auto &v : other)
+        emplace_back(std::move(v));
+      other.clear();
+    }
+  }
+
+  inline_vector &operator=(const inline_vector &other) {
+    if (this != &other) {
+      clear();
+      reserve(other.size());
+      for (auto &v : other)
+        emplace_back(v);
+    }
+    return *this;
+  }
+
+  inline_vector &operator=(inline_vector &&other) {
+    if (this != &other) {
+      clear();
+      if (!other.is_inline()) {
+        if (!is_inline())
+          std::allocator<T>().deallocate(items, cap);
+        items = other.items;
+        count = other.count;
+        cap = other.cap;
+        other.items = other.inline_data();
+        other.count = 0;
+        other.cap = N;
+      } else {
+        for (auto &v : other)
+          emplace_back(std::move(v));
+        other.clear();
+      }
+    }
+    return *this;
+  }
+
+  ~inline_vector() {
+    clear();
+    if (!is_inline())
+      std::allocator<T>().deallocate(items, cap);
+  }
+
+  size_type size() const { return count; }
+  size_type capacity() const { return cap; }
+  bool empty() const { return count == 0; }
+
+  // True whilst the elements are stored inline
+  bool is_inline() const { return items == inline_data(); }
+
+  iterator begin() { return items; }
+  iterator end() { return items + count; }
+  const_iterator begin() const { return items; }
+  const_iterator end() const { return items + count; }
+
+  T &operator[](size_type i) { return items[i]; }
+  const T &operator[](size_type i) const { return items[i]; }
+
+  T &at(size_type i) {
+    if (i >= count)
+      throw std::out_of_range("out of range");
+    return items[i];
+  }
+
+  const T &at(size_type i) const {
+    if (i >= count)
+      throw std::out_of_range("out of range");
+    return items[i];
+  }
+
+  T &front() { return items[0]; }
+  const T &front() const { return items[0]; }
+  T &back() { return items[count - 1]; }
+  const T &back() const { return items[count - 1]; }
+
+  template <typename... Args> void emplace_back(Args &&...args) {
+    if (count == cap) {
+      // Construct the new element first in case args refers to an element
+      auto new_cap = cap ? cap * 2 : 1;
+      auto new_items = std::allocator<T>().allocate(new_cap);
+      try {
+        std::construct_at(new_items + count, std::forward<Args>(args)...);
+      } catch (...) {
+        std::allocator<T>().deallocate(new_items, new_cap);
+        throw;
+      }
+      move_to(new_items, new_cap);
+    } else {
+      std::construct_at(items + count, std::forward<Args>(args)...);
+    }
+    ++count;
+  }
+
+  void push_back(const T &v) { emplace_back(v); }
+  void push_back(T &&v) { emplace_back(std::move(v)); }
+
+  void pop_back() { std::destroy_at(items + --count); }
+
+  void reserve(size_type n) {
+    if (n > cap)
+      move_to(std::allocator<T>().allocate(n), n);
+  }
+
+  void resize(size_type n) {
+    reserve(n);
+    while (count < n)
+      emplace_back();
+    while (count > n)
+      pop_back();
+  }
+
+  void clear() {
+    std::destroy(items, items + count);
+    count = 0;
+  }
+
+private:
+  T *inline_data() { return reinterpret_cast<T *>(buffer); }
+  const T *inline_data() const { return reinterpret_cast<const T *>(buffer); }
+
+  // Moves the elements to new heap storage
+  void move_to(T *new_items, size_type new_cap) {
+    std::uninitialized_move(items, items + count, new_items);
+    std::destroy(items, items + count);
+    if (!is_inline())
+      std::allocator<T>().deallocate(items, cap);
+    items = new_items;
+    cap = new_cap;
+  }
+
+  alignas(T) unsigned char buffer[N * sizeof(T)];
+  T *items;
+  size_type count, cap;
+};
+
+} // namespace detail
+
+// A vector that stores up to N elements inline without allocating.
+// Like all container writes, growing beyond N (which moves the elements to the
+// heap) throws invalid_write if any element is borrowed, whether it grows
+// through the container or through a write borrow of it.
+template <typename T, std::size_t N = 8, typename Mode = mode>
+using small_vector = container<detail::inline_vector<T, N>, Mode>;
+
+} // namespace safe
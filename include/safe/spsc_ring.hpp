@@ -0,0 +1,154 @@
+#pragma once
+
+#include "container.hpp"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <optional>
+
+namespace safe {
+
+// A lock-free ring buffer for one producer thread and one consumer thread.
+// The producer borrows a contiguous batch of free slots with write(), fills
+// them in place and commits them. The consumer borrows a batch of committed
+// slots with read() and releases them once it has finished with them.
+//
+// Each batch has its own lifetime, so committing or releasing slots that are
+// still referenced throws invalid_write, and a slot cannot be reused whilst
+// it is referenced. There can only be one batch at a time on each side.
+template <typename T, std::size_t N, typename Mode = mode> class spsc_ring {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "N must be a power of 2");
+  static constexpr std::size_t mask = N - 1;
+
+public:
+  using value_type = T;
+  using size_type = std::size_t;
+  using checks = detail::index_checks<Mode>;
+
+  // A contiguous batch of slots, borrowed by the producer or the consumer
+  class batch {
+  public:
+    size_type size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    ref<T, Mode> operator[](size_type i) {
+      checks::check_size(count, i);
+      return {ring.slots[(first + i) & mask], life.get_lifetime()};
+    }
+
+    ref<const T, Mode> operator[](size_type i) const {
+      checks::check_size(count, i);
+      return {ring.slots[(first + i) & mask], life.get_lifetime()};
+    }
+
+  protected:
+    friend class spsc_ring;
+
+    batch(spsc_ring &ring, size_type first, size_type count,
+          typename detail::lifetime<Mode>::reference side)
+        : ring(ring), first(first), count(count), side(side) {}
+
+    // Removes the first n slots from the batch
+    void advance(size_type n) {
+      if (n > count)
+        throw std::out_of_range("out of range");
+      detail::lock<exclusive_write, Mode> lock(life.get_lifetime());
+      first += n;
+      count -= n;
+    }
+
+    spsc_ring &ring;
+    size_type first, count;
+    detail::lock<exclusive_write, Mode> side;
+    mutable detail::lifetime<Mode> life;
+  };
+
+  class write_batch : public batch {
+  public:
+    // Publishes the first n slots to the consumer
+    void commit(size_type n) {
+      this->advance(n);
+      this->ring.tail.store(this->first, std::memory_order_release);
+    }
+
+    void commit() { commit(this->count); }
+
+  private:
+    friend class spsc_ring;
+    using batch::batch;
+  };
+
+  class read_batch : public batch {
+  public:
+    // Returns the first n slots to the producer
+    void release(size_type n) {
+      this->advance(n);
+      this->ring.head.store(this->first, std::memory_order_release);
+    }
+
+    void release() { release(this->count); }
+
+  private:
+    friend class spsc_ring;
+    using batch::batch;
+  };
+
+  spsc_ring() : slots(std::make_unique<T[]>(N)) {}
+
+  spsc_ring(const spsc_ring &) = delete;
+  spsc_ring &operator=(const spsc_ring &) = delete;
+
+  static constexpr size_type capacity() { return N; }
+
+  // Borrows up to n free slots, which may be fewer because the batch does not
+  // wrap around the end of the ring. Throws invalid_write if the producer
+  // already has a batch.
+  write_batch write(size_type n = N) {
+    auto t = tail.load(std::memory_order_relaxed);
+    auto h = head.load(std::memory_order_acquire);
+    n = std::min({n, N - (t - h), N - (t & mask)});
+    return {*this, t, n, producer.get_lifetime()};
+  }
+
+  // Borrows up to n committed slots. Throws invalid_write if the consumer
+  // already has a batch.
+  read_batch read(size_type n = N) {
+    auto h = head.load(std::memory_order_relaxed);
+    auto t = tail.load(std::memory_order_acquire);
+    n = std::min({n, t - h, N - (h & mask)});
+    return {*this, h, n, consumer.get_lifetime()};
+  }
+
+  // Returns false if the ring is full
+  template <typename U> bool try_push(U &&value) {
+    auto b = write(1);
+    if (b.empty())
+      return false;
+    *b[0] = std::forward<U>(value);
+    b.commit();
+    return true;
+  }
+
+  std::optional<T> try_pop() {
+    auto b = read(1);
+    if (b.empty())
+      return {};
+    std::optional<T> result = std::move(**b[0]);
+    b.release();
+    return result;
+  }
+
+  // Approximate if called whilst the other thread is active
+  size_type size() const {
+    return tail.load(std::memory_order_acquire) -
+           head.load(std::memory_order_acquire);
+  }
+
+private:
+  std::unique_ptr<T[]> slots;
+  alignas(64) std::atomic<size_type> head = 0; // Written by the consumer
+  alignas(64) std::atomic<size_type> tail = 0; // Written by the producer
+  alignas(64) mutable detail::lifetime<Mode> producer, consumer;
+};
+
+} // namespace safe
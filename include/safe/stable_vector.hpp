@@ -0,0 +1,237 @@
+#pragma once
+
+#include "container.hpp"
+#include <array>
+#include <bit>
+#include <memory>
+
+namespace safe {
+
+namespace detail {
+
+// Maps an index onto a table of segments that double in size.
+// Segment s holds segment_size(s) elements, so the table never needs to grow
+// and elements never move once constructed.
+struct segment_index {
+  static constexpr std::size_t first_bits = 3;
+  static constexpr std::size_t max_segments = 64 - first_bits;
+
+  explicit segment_index(std::size_t i) {
+    auto j = i + (std::size_t(1) << first_bits);
+    auto b = std::bit_width(j) - 1;
+    segment = b - first_bits;
+    offset = j - (std::size_t(1) << b);
+  }
+
+  static std::size_t segment_size(std::size_t s) {
+    return std::size_t(1) << (s + first_bits);
+  }
+
+  std::size_t segment, offset;
+};
+
+} // namespace detail
+
+// A vector whose elements never move.
+// Appending does not invalidate element references, so push_back() only
+// conflicts with borrows of the container itself (for example iterators), and
+// only operations that destroy elements check the element borrows.
+template <typename T, typename Mode = mode> class stable_vector {
+public:
+  using value_type = T;
+  using size_type = std::size_t;
+  using lifetime_type = detail::lifetime<Mode>;
+  using checks = detail::index_checks<Mode>;
+
+  template <typename ValueRef, typename VectorPtr> class iterator_impl {
+  public:
+    iterator_impl() : vec{}, index{} {}
+
+    iterator_impl(VectorPtr vec, size_type index)
+        : vec(vec), index(index), container_lock(vec->container_lifetime()) {}
+
+    ValueRef operator*() const {
+      if (!vec)
+        throw std::out_of_range("uninitialized iterator");
+      return (*vec)[index];
+    }
+
+    iterator_impl &operator++() {
+      if (!vec)
+        throw std::out_of_range("uninitialized iterator");
+      checks::check_size(vec->size() + 1, index + 1);
+      ++index;
+      return *this;
+    }
+
+    iterator_impl &operator--() {
+      if (!vec)
+        throw std::out_of_range("uninitialized iterator");
+      checks::check_size(vec->size() + 1, index - 1);
+      --index;
+      return *this;
+    }
+
+    bool operator==(const iterator_impl &other) const {
+      return index == other.index;
+    }
+    bool operator!=(const iterator_impl &other) const {
+      return index != other.index;
+    }
+
+  private:
+    VectorPtr vec;
+    size_type index;
+    detail::optional_lock<shared_read, Mode> container_lock;
+  };
+
+  using iterator = iterator_impl<ref<T, Mode>, stable_vector *>;
+  using const_iterator =
+      iterator_impl<ref<const T, Mode>, const stable_vector *>;
+
+  stable_vector() : segments{}, count(0) {}
+
+  stable_vector(std::initializer_list<value_type> il) : stable_vector() {
+    for (auto &v : il)
+      emplace_back(v);
+  }
+
+  stable_vector(const stable_vector &other) : stable_vector() {
+    detail::lock<shared_read, Mode> lock(other.container_lifetime());
+    for (size_type i = 0; i < other.size(); ++i)
+      emplace_back(other.get(i));
+  }
+
+  stable_vector &operator=(const stable_vector &) = delete;
+
+  ~stable_vector() {
+    element_access.terminate_if_live();
+    container_access.terminate_if_live();
+    destroy(0);
+    for (size_type s = 0; s < segments.size() && segments[s]; ++s)
+      std::allocator<T>().deallocate(segments[s],
+                                     detail::segment_index::segment_size(s));
+  }
+
+  size_type size() const { return count.load(std::memory_order_acquire); }
+  bool empty() const { return size() == 0; }
+
+  // Appending never moves existing elements, so outstanding element
+  // references remain valid.
+  template <typename... Args> void emplace_back(Args &&...args) {
+    detail::lock<exclusive_write, Mode> lock(container_access.get_lifetime());
+    auto n = count.load(std::memory_order_relaxed);
+    detail::segment_index idx(n);
+    if (!segments[idx.segment])
+      segments[idx.segment] = std::allocator<T>().allocate(
+          detail::segment_index::segment_size(idx.segment));
+    std::construct_at(segments[idx.segment] + idx.offset,
+                      std::forward<Args>(args)...);
+    count.store(n + 1, std::memory_order_release);
+  }
+
+  void push_back(const value_type &v) { emplace_back(v); }
+  void push_back(value_type &&v) { emplace_back(std::move(v)); }
+
+  // These operations destroy elements, so they must not have any element
+  // borrows.
+  void pop_back() {
+    auto lock = write_elements();
+    auto n = size();
+    if (n == 0)
+      throw std::out_of_range("empty container");
+    destroy(n - 1);
+  }
+
+  void clear() {
+    auto lock = write_elements();
+    destroy(0);
+  }
+
+  ref<value_type, Mode> operator[](size_type i) {
+    checks::check_size(size(), i);
+    return {get(i), element_access.get_lifetime()};
+  }
+
+  ref<const value_type, Mode> operator[](size_type i) const {
+    checks::check_size(size(), i);
+    return {get(i), element_access.get_lifetime()};
+  }
+
+  ref<value_type, Mode> at(size_type i) {
+    if (i >= size())
+      throw std::out_of_range("out of range");
+    return {get(i), element_access.get_lifetime()};
+  }
+
+  ref<const value_type, Mode> at(size_type i) const {
+    if (i >= size())
+      throw std::out_of_range("out of range");
+    return {get(i), element_access.get_lifetime()};
+  }
+
+  ref<value_type, Mode> front() {
+    if (empty())
+      throw std::out_of_range("empty container");
+    return {get(0), element_access.get_lifetime()};
+  }
+
+  ref<const value_type, Mode> front() const {
+    if (empty())
+      throw std::out_of_range("empty container");
+    return {get(0), element_access.get_lifetime()};
+  }
+
+  ref<value_type, Mode> back() {
+    if (empty())
+      throw std::out_of_range("empty container");
+    return {get(size() - 1), element_access.get_lifetime()};
+  }
+
+  ref<const value_type, Mode> back() const {
+    if (empty())
+      throw std::out_of_range("empty container");
+    return {get(size() - 1), element_access.get_lifetime()};
+  }
+
+  // Iterators borrow the container, so they prevent appends
+  iterator begin() { return {this, 0}; }
+  iterator end() { return {this, size()}; }
+  const_iterator begin() const { return {this, 0}; }
+  const_iterator end() const { return {this, size()}; }
+
+  typename lifetime_type::reference container_lifetime() const {
+    return container_access.get_lifetime();
+  }
+
+  typename lifetime_type::reference element_lifetime() const {
+    return element_access.get_lifetime();
+  }
+
+private:
+  struct element_write_lock {
+    detail::lock<exclusive_write, Mode> container, elements;
+  };
+
+  element_write_lock write_elements() {
+    return {container_access.get_lifetime(), element_access.get_lifetime()};
+  }
+
+  value_type &get(size_type i) const {
+    detail::segment_index idx(i);
+    return segments[idx.segment][idx.offset];
+  }
+
+  // Destroys all elements from index `from`
+  void destroy(size_type from) {
+    for (auto n = size(); n > from; --n)
+      std::destroy_at(&get(n - 1));
+    count.store(from, std::memory_order_release);
+  }
+
+  std::array<T *, detail::segment_index::max_segments> segments;
+  std::atomic<size_type> count;
+  mutable detail::lifetime<Mode> container_access, element_access;
+};
+
+} // namespace safe
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "string.hpp"
+#include <compare>
+#include <ostream>
+#include <string_view>
+
+namespace safe {
+
+// A read-only view of a safe string that does not copy the characters.
+// The view borrows the string and its elements for reading, so the string
+// cannot be modified whilst the view is live, and destroying the string
+// whilst it has live views terminates the program, just like ref.
+template <typename Mode> class basic_string_view {
+public:
+  using size_type = std::string_view::size_type;
+  using string_type = container<std::string, Mode>;
+
+  static constexpr size_type npos = std::string_view::npos;
+
+  basic_string_view() {}
+
+  basic_string_view(const string_type &str)
+      : view(str.value.container), container_lock(str.value.lifetime()),
+        element_lock(str.value.element_lifetime()) {}
+
+  size_type size() const { return view.size(); }
+  size_type length() const { return view.size(); }
+  bool empty() const { return view.empty(); }
+
+  char operator[](size_type i) const {
+    detail::index_checks<Mode>::check_size(view.size(), i);
+    return view[i];
+  }
+
+  char at(size_type i) const { return view.at(i); }
+
+  char front() const {
+    if (view.empty())
+      throw std::out_of_range("empty string");
+    return view.front();
+  }
+
+  char back() const {
+    if (view.empty())
+      throw std::out_of_range("empty string");
+    return view.back();
+  }
+
+  // The substring shares the borrow of this view.
+  // Throws std::out_of_range if pos > size().
+  basic_string_view substr(size_type pos, size_type n = npos) const {
+    basic_string_view result = *this;
+    result.view = view.substr(pos, n);
+    return result;
+  }
+
+  size_type find(std::string_view s, size_type pos = 0) const {
+    return view.find(s, pos);
+  }
+
+  size_type find(char c, size_type pos = 0) const { return view.find(c, pos); }
+
+  size_type rfind(std::string_view s, size_type pos = npos) const {
+    return view.rfind(s, pos);
+  }
+
+  size_type rfind(char c, size_type pos = npos) const {
+    return view.rfind(c, pos);
+  }
+
+  bool starts_with(std::string_view s) const { return view.starts_with(s); }
+  bool ends_with(std::string_view s) const { return view.ends_with(s); }
+
+  bool contains(std::string_view s) const { return find(s) != npos; }
+
+  int compare(std::string_view s) const { return view.compare(s); }
+
+  bool operator==(const basic_string_view &other) const {
+    return view == other.view;
+  }
+
+  bool operator==(std::string_view s) const { return view == s; }
+
+  std::strong_ordering operator<=>(const basic_string_view &other) const {
+    return view <=> other.view;
+  }
+
+  std::strong_ordering operator<=>(std::string_view s) const {
+    return view <=> s;
+  }
+
+  // Copies the characters
+  std::string str() const { return std::string(view); }
+
+  friend std::ostream &operator<<(std::ostream &os,
+                                  const basic_string_view &v) {
+    return os << v.view;
+  }
+
+private:
+  std::string_view view;
+  detail::optional_lock<shared_read, Mode> container_lock, element_lock;
+};
+
+using string_view = basic_string_view<mode>;
+
+} // namespace safe
@@ -0,0 +1,273 @@
+#pragma once
+
+#include "container.hpp"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+
+namespace safe {
+
+// A hash map using open addressing with linear probing.
+// Elements are borrowed per group of group_size buckets, so references to
+// elements in different groups do not conflict. Erased elements leave a
+// tombstone, so elements only move when the table is rehashed, and a rehash
+// throws invalid_write if any element is borrowed.
+template <typename K, typename V, typename Mode = mode,
+          typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K>>
+class unordered_map {
+public:
+  using key_type = K;
+  using mapped_type = V;
+  using value_type = std::pair<const K, V>;
+  using size_type = std::size_t;
+  using lifetime_type = detail::lifetime<Mode>;
+
+  static constexpr size_type group_size = 16;
+
+  template <typename ValueRef, typename MapPtr> class iterator_impl {
+  public:
+    iterator_impl() : map{}, index{} {}
+
+    iterator_impl(MapPtr map, size_type index)
+        : map(map), index(map->next_full(index)),
+          container_lock(map->container_access.get_lifetime()) {}
+
+    ValueRef operator*() const {
+      if (!map)
+        throw std::out_of_range("uninitialized iterator");
+      if (index >= map->buckets)
+        throw std::out_of_range("out of range");
+      return {*map->slots[index], map->group_lifetime(index)};
+    }
+
+    iterator_impl &operator++() {
+      if (!map)
+        throw std::out_of_range("uninitialized iterator");
+      if (index >= map->buckets)
+        throw std::out_of_range("out of range");
+      index = map->next_full(index + 1);
+      return *this;
+    }
+
+    bool operator==(const iterator_impl &other) const {
+      return index == other.index;
+    }
+    bool operator!=(const iterator_impl &other) const {
+      return index != other.index;
+    }
+
+  private:
+    MapPtr map;
+    size_type index;
+    detail::optional_lock<shared_read, Mode> container_lock;
+  };
+
+  using iterator = iterator_impl<ref<value_type, Mode>, unordered_map *>;
+  using const_iterator =
+      iterator_impl<ref<const value_type, Mode>, const unordered_map *>;
+
+  unordered_map() { allocate(group_size); }
+
+  unordered_map(std::initializer_list<value_type> il) : unordered_map() {
+    for (auto &v : il)
+      try_emplace(v.first, v.second);
+  }
+
+  unordered_map(const unordered_map &other) : unordered_map() {
+    for (auto i : other)
+      try_emplace(i->first, i->second);
+  }
+
+  unordered_map &operator=(const unordered_map &) = delete;
+
+  size_type size() const { return count; }
+  bool empty() const { return count == 0; }
+  size_type bucket_count() const { return buckets; }
+
+  size_type bucket(const K &key) const {
+    detail::lock<shared_read, Mode> lock(container_access.get_lifetime());
+    auto i = find(key, hash(key));
+    if (i == npos)
+      throw std::out_of_range("key not found");
+    return i;
+  }
+
+  bool contains(const K &key) const {
+    detail::lock<shared_read, Mode> lock(container_access.get_lifetime());
+    return find(key, hash(key)) != npos;
+  }
+
+  // Borrows the element's bucket group
+  ref<V, Mode> at(const K &key) {
+    detail::lock<shared_read, Mode> lock(container_access.get_lifetime());
+    auto i = find(key, hash(key));
+    if (i == npos)
+      throw std::out_of_range("key not found");
+    return {slots[i]->second, group_lifetime(i)};
+  }
+
+  ref<const V, Mode> at(const K &key) const {
+    detail::lock<shared_read, Mode> lock(container_access.get_lifetime());
+    auto i = find(key, hash(key));
+    if (i == npos)
+      throw std::out_of_range("key not found");
+    return {slots[i]->second, group_lifetime(i)};
+  }
+
+  // Inserts a default-constructed value if the key is missing.
+  ref<V, Mode> operator[](const K &key) {
+    try_emplace(key);
+    return at(key);
+  }
+
+  // Inserts the element if the key is missing, and returns whether it was
+  // inserted. Only throws invalid_write if the insertion needs to rehash
+  // whilst elements are borrowed.
+  template <typename... Args> bool try_emplace(const K &key, Args &&...args) {
+    detail::lock<exclusive_write, Mode> lock(container_access.get_lifetime());
+    auto h = hash(key);
+    if (find(key, h) != npos)
+      return false;
+    if ((used + 1) * 8 > buckets * 7)
+      rehash(count * 2 + 1 > buckets / 2 ? buckets * 2 : buckets);
+
+    auto i = insert_position(h);
+    slots[i].emplace(std::piecewise_construct, std::forward_as_tuple(key),
+                     std::forward_as_tuple(std::forward<Args>(args)...));
+    if (ctrl[i] == empty_slot)
+      ++used;
+    ctrl[i] = h2(h);
+    ++count;
+    return true;
+  }
+
+  bool insert(const value_type &v) { return try_emplace(v.first, v.second); }
+
+  // Assigning an existing element borrows its bucket group.
+  template <typename M> bool insert_or_assign(const K &key, M &&v) {
+    {
+      detail::lock<exclusive_write, Mode> lock(container_access.get_lifetime());
+      auto i = find(key, hash(key));
+      if (i != npos) {
+        detail::lock<exclusive_write, Mode> group(group_lifetime(i));
+        slots[i]->second = std::forward<M>(v);
+        return false;
+      }
+    }
+    return try_emplace(key, std::forward<M>(v));
+  }
+
+  // Erasing an element only checks the borrows of its bucket group.
+  size_type erase(const K &key) {
+    detail::lock<exclusive_write, Mode> lock(container_access.get_lifetime());
+    auto i = find(key, hash(key));
+    if (i == npos)
+      return 0;
+    detail::lock<exclusive_write, Mode> group(group_lifetime(i));
+    slots[i].reset();
+    ctrl[i] = deleted_slot;
+    --count;
+    return 1;
+  }
+
+  void clear() {
+    detail::lock<exclusive_write, Mode> lock(container_access.get_lifetime());
+    check_no_borrows();
+    allocate(group_size);
+  }
+
+  iterator begin() { return {this, 0}; }
+  iterator end() { return {this, buckets}; }
+  const_iterator begin() const { return {this, 0}; }
+  const_iterator end() const { return {this, buckets}; }
+
+  typename lifetime_type::reference container_lifetime() const {
+    return container_access.get_lifetime();
+  }
+
+private:
+  static constexpr size_type npos = -1;
+  static constexpr std::uint8_t empty_slot = 0x80, deleted_slot = 0xfe;
+
+  // Mixes the hash so that identity hashes still spread over the table
+  static size_type hash(const K &key) {
+    std::uint64_t h = Hash()(key) * 0x9e3779b97f4a7c15ull;
+    return h ^ (h >> 32);
+  }
+  static std::uint8_t h2(size_type h) { return h & 0x7f; }
+
+  typename lifetime_type::reference group_lifetime(size_type i) const {
+    return groups[i / group_size].get_lifetime();
+  }
+
+  // Probes the control bytes, which are dense, and only compares keys when the
+  // hash bits match.
+  size_type find(const K &key, size_type h) const {
+    auto mask = buckets - 1;
+    auto tag = h2(h);
+    for (auto i = (h >> 7) & mask;; i = (i + 1) & mask) {
+      if (ctrl[i] == tag && KeyEqual()(slots[i]->first, key))
+        return i;
+      if (ctrl[i] == empty_slot)
+        return npos;
+    }
+  }
+
+  size_type insert_position(size_type h) const {
+    auto mask = buckets - 1;
+    for (auto i = (h >> 7) & mask;; i = (i + 1) & mask) {
+      if (ctrl[i] == empty_slot || ctrl[i] == deleted_slot)
+        return i;
+    }
+  }
+
+  size_type next_full(size_type i) const {
+    while (i < buckets && (ctrl[i] & 0x80))
+      ++i;
+    return i;
+  }
+
+  void check_no_borrows() const {
+    for (size_type g = 0; g < buckets / group_size; ++g)
+      detail::lock<exclusive_write, Mode> group(groups[g].get_lifetime());
+  }
+
+  void allocate(size_type n) {
+    groups = std::make_unique<detail::lifetime<Mode>[]>(n / group_size);
+    slots = std::make_unique<std::optional<value_type>[]>(n);
+    ctrl = std::make_unique<std::uint8_t[]>(n);
+    std::fill_n(ctrl.get(), n, empty_slot);
+    buckets = n;
+    count = used = 0;
+  }
+
+  // Moves every element, so no element may be borrowed.
+  void rehash(size_type n) {
+    check_no_borrows();
+    auto old_slots = std::move(slots);
+    auto old_ctrl = std::move(ctrl);
+    auto old_buckets = buckets;
+    allocate(n);
+    for (size_type i = 0; i < old_buckets; ++i) {
+      if (old_ctrl[i] & 0x80)
+        continue;
+      auto h = hash(old_slots[i]->first);
+      auto j = insert_position(h);
+      slots[j].emplace(std::move(*old_slots[i]));
+      ctrl[j] = h2(h);
+      ++used;
+      ++count;
+    }
+  }
+
+  // Declared first so that the elements are destroyed after the lifetimes
+  // have checked that there are no borrows.
+  std::unique_ptr<std::optional<value_type>[]> slots;
+  std::unique_ptr<std::uint8_t[]> ctrl;
+  size_type buckets, count, used;
+  std::unique_ptr<detail::lifetime<Mode>[]> groups;
+  mutable detail::lifetime<Mode> container_access;
+};
+
+} // namespace safe
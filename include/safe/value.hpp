@@ -36,6 +36,9 @@ public:
 
   value(T&&src) : _value(std::move(src)) {}
 
+  // Throws invalid_write if src is borrowed
+  value(value &&src) : _value(std::move(**src.write())) {}
+
   ref<const T, mode> read() const { return {_value, life.get_lifetime()}; }
   ref<T, mode> write() { return {_value, life.get_lifetime()}; }
 
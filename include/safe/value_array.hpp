@@ -0,0 +1,253 @@
+#pragma once
+
+#include "container.hpp"
+#include <array>
+#include <cstdint>
+#include <memory>
+
+namespace safe {
+
+namespace detail {
+
+// Storage for one byte of borrow state per element, either inline when the
+// size is known at compile time, or on the heap when N is 0.
+template <std::size_t N> struct compact_states {
+  explicit compact_states(std::size_t) {}
+  std::atomic<std::uint8_t> &operator[](std::size_t i) { return states[i]; }
+  const std::atomic<std::uint8_t> &operator[](std::size_t i) const {
+    return states[i];
+  }
+  std::array<std::atomic<std::uint8_t>, N> states{};
+};
+
+template <> struct compact_states<0> {
+  explicit compact_states(std::size_t n)
+      : states(new std::atomic<std::uint8_t>[n]()) {}
+  std::atomic<std::uint8_t> &operator[](std::size_t i) { return states[i]; }
+  const std::atomic<std::uint8_t> &operator[](std::size_t i) const {
+    return states[i];
+  }
+  std::unique_ptr<std::atomic<std::uint8_t>[]> states;
+};
+
+// Borrow state for an array of values, stored separately from the values.
+template <typename Mode, std::size_t N = 0> class compact_lifetimes {
+public:
+  explicit compact_lifetimes(std::size_t) {}
+
+  struct reference {};
+  reference get(std::size_t) { return {}; }
+
+  static void acquire_read(reference) {}
+  static void release_read(reference) {}
+  static void acquire_write(reference) {}
+  static void release_write(reference) {}
+  void acquire_bulk() {}
+  void release_bulk() {}
+  void terminate_if_live(std::size_t) const {}
+};
+
+// Each element has one byte of state: the top bit is set for a writer, and the
+// remaining bits count the readers. Element writers are also counted for the
+// whole array so that bulk reads only need to check one counter.
+template <std::size_t N> class compact_lifetimes<checked, N> {
+public:
+  static constexpr std::uint8_t writer = 0x80, max_readers = 0x7f;
+
+  explicit compact_lifetimes(std::size_t n)
+      : states(n), element_writers(0), bulk_readers(0) {}
+
+  struct reference {
+    compact_lifetimes *owner;
+    std::atomic<std::uint8_t> *state;
+  };
+
+  reference get(std::size_t i) { return {this, &states[i]}; }
+
+  static void acquire_read(reference r) {
+    auto s = r.state->load();
+    do {
+      if (s & writer)
+        throw invalid_read();
+      if (s == max_readers)
+        throw invalid_read(); // Too many readers
+    } while (!r.state->compare_exchange_weak(s, s + 1));
+  }
+
+  static void release_read(reference r) { --*r.state; }
+
+  static void acquire_write(reference r) {
+    auto &owner = *r.owner;
+    ++owner.element_writers;
+    if (owner.bulk_readers) {
+      --owner.element_writers;
+      throw invalid_write();
+    }
+    std::uint8_t expected = 0;
+    if (!r.state->compare_exchange_strong(expected, writer)) {
+      --owner.element_writers;
+      throw invalid_write();
+    }
+  }
+
+  static void release_write(reference r) {
+    *r.state = 0;
+    --r.owner->element_writers;
+  }
+
+  void acquire_bulk() {
+    ++bulk_readers;
+    if (element_writers) {
+      --bulk_readers;
+      throw invalid_read();
+    }
+  }
+
+  void release_bulk() { --bulk_readers; }
+
+  void terminate_if_live(std::size_t n) const {
+    if (bulk_readers)
+      std::terminate();
+    for (std::size_t i = 0; i < n; ++i)
+      if (states[i])
+        std::terminate();
+  }
+
+private:
+  compact_states<N> states;
+  std::atomic<int> element_writers, bulk_readers;
+};
+
+template <typename T, typename Lifetimes> class compact_ref;
+
+// An immutable reference to an element
+template <typename T, typename Lifetimes> class compact_ref<const T, Lifetimes> {
+public:
+  using life_ref = typename Lifetimes::reference;
+
+  compact_ref(const T &value, life_ref life) : value(value), life(life) {
+    Lifetimes::acquire_read(life);
+  }
+
+  compact_ref(const compact_ref &other) : compact_ref(other.value, other.life) {}
+
+  ~compact_ref() { Lifetimes::release_read(life); }
+
+  const T &operator*() const { return value; }
+  const T *operator->() const { return &value; }
+  operator const T &() const { return value; }
+
+private:
+  const T &value;
+  life_ref life;
+};
+
+// A mutable reference to an element
+template <typename T, typename Lifetimes> class compact_ref {
+public:
+  using life_ref = typename Lifetimes::reference;
+
+  compact_ref(T &value, life_ref life) : value(value), life(life) {
+    Lifetimes::acquire_write(life);
+  }
+
+  compact_ref(const compact_ref &) = delete;
+
+  ~compact_ref() { Lifetimes::release_write(life); }
+
+  T &operator*() const { return value; }
+  T *operator->() const { return &value; }
+
+  template <typename U> compact_ref &operator=(U &&v) {
+    value = std::forward<U>(v);
+    return *this;
+  }
+
+private:
+  T &value;
+  life_ref life;
+};
+
+// Borrows every element for reading, which is only possible when there are
+// no element writers. Whilst it is live, the values can be read directly as
+// a contiguous array.
+template <typename T, typename Lifetimes, typename Mode> class bulk_reader {
+public:
+  bulk_reader(const T *values, std::size_t count, Lifetimes &lifetimes)
+      : values(values), count(count), lifetimes(lifetimes) {
+    lifetimes.acquire_bulk();
+  }
+
+  bulk_reader(const bulk_reader &) = delete;
+
+  ~bulk_reader() { lifetimes.release_bulk(); }
+
+  const T *begin() const { return values; }
+  const T *end() const { return values + count; }
+  std::size_t size() const { return count; }
+
+  const T &operator[](std::size_t i) const {
+    index_checks<Mode>::check_size(count, i);
+    return values[i];
+  }
+
+private:
+  const T *values;
+  std::size_t count;
+  Lifetimes &lifetimes;
+};
+
+} // namespace detail
+
+// A fixed-size array of values, each of which can be borrowed like a value<T>.
+// The values are stored densely, and the borrow state is stored in a separate
+// array of one byte per element. An element can have at most 127 readers.
+template <typename T, typename Mode = mode> class value_array {
+  using lifetimes_type = detail::compact_lifetimes<Mode>;
+
+public:
+  using value_type = T;
+  using size_type = std::size_t;
+  using checks = detail::index_checks<Mode>;
+  using reference = detail::compact_ref<T, lifetimes_type>;
+  using const_reference = detail::compact_ref<const T, lifetimes_type>;
+  using bulk_reader = detail::bulk_reader<T, lifetimes_type, Mode>;
+
+  explicit value_array(size_type n, const T &init = T())
+      : values(new T[n]), count(n), lifetimes(n) {
+    std::fill_n(values.get(), n, init);
+  }
+
+  value_array(std::initializer_list<T> il) : value_array(il.size()) {
+    std::copy(il.begin(), il.end(), values.get());
+  }
+
+  value_array(const value_array &) = delete;
+  value_array &operator=(const value_array &) = delete;
+
+  ~value_array() { lifetimes.terminate_if_live(count); }
+
+  size_type size() const { return count; }
+
+  const_reference read(size_type i) const {
+    checks::check_size(count, i);
+    return {values[i], lifetimes.get(i)};
+  }
+
+  reference write(size_type i) {
+    checks::check_size(count, i);
+    return {values[i], lifetimes.get(i)};
+  }
+
+  const_reference operator[](size_type i) const { return read(i); }
+  reference operator[](size_type i) { return write(i); }
+
+  bulk_reader read_all() const { return {values.get(), count, lifetimes}; }
+
+private:
+  std::unique_ptr<T[]> values;
+  size_type count;
+  mutable lifetimes_type lifetimes;
+};
+
+} // namespace safe
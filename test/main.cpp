@@ -7,6 +7,9 @@
 // This is support for basic values
 #include <safe/value.hpp>
 
+// Copy-on-write values
+#include <safe/cow.hpp>
+
 // This is support for containers
 
 // Safe strings
@@ -15,7 +18,123 @@
 // Safe vectors
 #include <safe/vector.hpp>
 
+// Vectors with stable element addresses
+#include <safe/stable_vector.hpp>
+
+// Vectors that can be appended to from many threads
+#include <safe/concurrent_vector.hpp>
+
+// Hash maps
+#include <safe/unordered_map.hpp>
+
+// Sorted maps and sets in contiguous storage
+#include <safe/flat_set.hpp>
+
+// Generational handles
+#include <safe/slot_map.hpp>
+
+// Object pools
+#include <safe/pool.hpp>
+
+// Objects that can point to themselves
+#include <safe/self.hpp>
+
+// Dense arrays of values
+#include <safe/value_array.hpp>
+
+// Fixed-size arrays
+#include <safe/array.hpp>
+
+// Vectors with inline storage
+#include <safe/small_vector.hpp>
+
+// Views of strings
+#include <safe/string_view.hpp>
+
+// Ropes for large text
+#include <safe/rope.hpp>
+
+// Vectors with cheap snapshots
+#include <safe/persistent_vector.hpp>
+
+// Immutable containers
+#include <safe/frozen.hpp>
+
+// Memory-mapped files
+#include <safe/mapped_array.hpp>
+
+// Buffers for file descriptors
+#include <safe/io_buffer.hpp>
+
+// Binary serialization
+#include <safe/serialize.hpp>
+
+// Values in shared memory
+#include <safe/shm.hpp>
+
+// Ring buffers between two threads
+#include <safe/spsc_ring.hpp>
+
+// Channels between threads
+#include <safe/channel.hpp>
+
+// Borrows in coroutines
+#include <safe/async.hpp>
+
+// Borrowing several objects at once
+#include <safe/borrow.hpp>
+
+// Parallel tasks with declared borrows
+#include <safe/scheduler.hpp>
+
+#include <filesystem>
+#include <fstream>
 #include <list>
+#include <memory>
+#include <thread>
+
+#include <sys/wait.h>
+
+struct node : public safe::enable_safe_from_this<node> {
+  int value = 0;
+  safe::ptr<node> next;
+};
+
+struct weak_node : public safe::enable_safe_from_this<weak_node, safe::weak> {
+  int value = 0;
+};
+
+// Counts copies, to check that values are moved
+struct copy_counter {
+  static inline int copies = 0;
+  copy_counter() = default;
+  copy_counter(const copy_counter &) { ++copies; }
+  copy_counter(copy_counter &&) = default;
+  copy_counter &operator=(const copy_counter &) {
+    ++copies;
+    return *this;
+  }
+  copy_counter &operator=(copy_counter &&) = default;
+};
+
+safe::task append_twice(safe::async_value<std::string> &log, char c) {
+  for (int i = 0; i < 2; ++i) {
+    auto w = co_await log.async_write();
+    w->push_back(c);
+    co_await safe::yield(); // Other tasks wait for the borrow
+  }
+}
+
+safe::task count_reads(safe::async_value<std::string> &log, int &count) {
+  auto r = co_await log.async_read();
+  ++count;
+  co_await safe::yield();
+}
+
+safe::task throw_invalid_write(safe::async_value<std::string> &log) {
+  auto r = co_await log.async_read();
+  log.write();
+}
 
 int main() {
   // Namespace - all symbols are in the `safe` namespace
@@ -446,5 +565,1075 @@ int main() {
       // Expected
     }
   }
+
+  // Stable vectors
+  {
+    stable_vector<int> vec = {1, 2, 3};
+
+    // Elements never move, so you can append whilst holding element references
+    ref<int> r = vec[0];
+    for (int i = 0; i < 100; i++)
+      vec.push_back(i);
+    *r = 10;
+    assert(vec.size() == 103);
+
+    // But you cannot destroy elements whilst they are borrowed
+    assert_throws<invalid_write>([&] { vec.pop_back(); });
+    assert_throws<invalid_write>([&] { vec.clear(); });
+    assert_throws<std::out_of_range>([&] { vec.at(103); });
+  }
+
+  {
+    stable_vector<int> vec = {1, 2, 3};
+    int sum = 0;
+    for (auto i : vec) {
+      sum += *i;
+      // Iterators borrow the container
+      assert_throws<invalid_write>([&] { vec.push_back(4); });
+    }
+    assert(sum == 6);
+    vec.pop_back();
+    assert(*vec.back() == 2);
+    vec.clear();
+    assert(vec.empty());
+  }
+
+  // Concurrent vectors
+  {
+    concurrent_vector<int> vec;
+    vec.push_back(-1);
+
+    // Readers can borrow published elements whilst other threads append
+    ref<const int> first = vec[0];
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+      threads.emplace_back([&] {
+        for (int i = 0; i < 1000; i++)
+          vec.push_back(i);
+      });
+    for (auto &t : threads)
+      t.join();
+
+    assert(*first == -1);
+    assert(vec.size() == 4001);
+
+    int sum = 0;
+    for (auto i : vec)
+      sum += *i;
+    assert(sum == 4 * 999 * 1000 / 2 - 1);
+
+    assert_throws<std::out_of_range>([&] { vec.at(4001); });
+
+    // Destroying elements needs exclusive access
+    assert_throws<invalid_write>([&] { vec.clear(); });
+  }
+
+  // Hash maps
+  {
+    safe::unordered_map<int, int> map = {{1, 10}, {2, 20}};
+    assert(map.size() == 2);
+    assert(*map.at(1) == 10);
+    assert(!map.contains(3));
+    assert_throws<std::out_of_range>([&] { map.at(3); });
+
+    for (int i = 0; i < 40; i++)
+      map.try_emplace(i, i * 10);
+    std::size_t b = map.bucket_count();
+
+    // Elements are borrowed per group of buckets, so elements in different
+    // groups can be borrowed at the same time.
+    auto group = [&](int k) {
+      return map.bucket(k) / safe::unordered_map<int, int>::group_size;
+    };
+    int other = 1;
+    while (group(other) == group(0))
+      other++;
+
+    ref<int> r = map.at(0);
+    *r = 5;
+    *map.at(other) = 6;
+
+    // Inserting without rehashing is fine whilst elements are borrowed
+    map.try_emplace(100, 1);
+    assert(map.bucket_count() == b);
+
+    // Erasing the borrowed element is not, but erasing others is
+    assert_throws<invalid_write>([&] { map.erase(0); });
+    assert(map.erase(other) == 1);
+
+    // Inserting enough to rehash is not allowed either
+    assert_throws<invalid_write>([&] {
+      for (int i = 200; i < 300; i++)
+        map.try_emplace(i, i);
+    });
+  }
+
+  {
+    safe::unordered_map<std::string, int> map;
+    map["a"] = 1;
+    map.insert_or_assign("a", 2);
+    map.insert_or_assign("b", 3);
+    int sum = 0;
+    for (auto i : map) {
+      sum += i->second;
+      // Iterators borrow the container
+      assert_throws<invalid_write>([&] { map.erase("a"); });
+    }
+    assert(sum == 5);
+    assert(map.erase("a") == 1);
+    assert(map.erase("a") == 0);
+    map.clear();
+    assert(map.empty());
+  }
+
+  // Flat maps and sets
+  {
+    // Built from unsorted input with a single sort
+    flat_map<int, std::string> map = {{3, "c"}, {1, "a"}, {2, "b"}, {1, "x"}};
+    assert(map.size() == 3);
+    assert(**map.at(1) == "a");
+    assert_throws<std::out_of_range>([&] { map.at(4); });
+
+    // Look up many keys under a single borrow
+    std::vector<int> keys = {1, 2, 4, 3, 1};
+    std::vector<std::string> found;
+    map.lookup(keys.begin(), keys.end(), std::back_inserter(found), "?");
+    assert((found == std::vector<std::string>{"a", "b", "?", "c", "a"}));
+
+    {
+      // Insertion moves elements, so is not allowed whilst they are borrowed
+      ref<std::string> r = map.at(2);
+      assert_throws<invalid_write>([&] { map.insert(5, "e"); });
+      assert_throws<invalid_write>([&] { map.erase(1); });
+    }
+    assert(map.insert(5, "e"));
+    assert(!map.insert(5, "f"));
+    assert(map.erase(1) == 1);
+
+    std::string all;
+    for (auto i : map)
+      all += i->second;
+    assert(all == "bce");
+  }
+
+  {
+    flat_set<int> set = {5, 1, 3, 3};
+    assert(set.size() == 3);
+    assert(set.contains(3));
+    assert(!set.contains(2));
+
+    std::vector<int> keys = {1, 2, 3, 4, 5};
+    std::vector<bool> found;
+    set.contains(keys.begin(), keys.end(), std::back_inserter(found));
+    assert((found == std::vector<bool>{true, false, true, false, true}));
+  }
+
+  // Slot maps
+  {
+    static_assert(sizeof(handle<int>) == 8);
+    static_assert(std::is_trivially_copyable_v<handle<int>>);
+
+    slot_map<int> map;
+    handle<int> h1 = map.insert(1), h2 = map.insert(2);
+    assert(*map[h1] == 1);
+    assert(map.size() == 2);
+
+    {
+      // Erasing a borrowed element is not allowed
+      ref<const int> r = std::as_const(map)[h2];
+      assert_throws<invalid_write>([&] { map.erase(h2); });
+    }
+
+    // Stale handles are detected when dereferenced
+    map.erase(h1);
+    assert(!map.contains(h1));
+    assert_throws<expired_pointer>([&] { map[h1]; });
+
+    // The slot is reused with a new generation
+    handle<int> h3 = map.insert(3);
+    assert(h3.index == h1.index);
+    assert_throws<expired_pointer>([&] { map[h1]; });
+    assert(*map[h3] == 3);
+
+    handle<int> null;
+    assert_throws<null_pointer>([&] { map[null]; });
+  }
+
+  // Object pools
+  {
+    pool<std::string> strings;
+    ptr<std::string> p1 = strings.make("Hello");
+    ptr<const std::string> p2 = p1;
+    assert(**p2 == "Hello");
+
+    {
+      // Borrowed objects cannot be released
+      auto r = *p1;
+      assert_throws<invalid_write>([&] { strings.release(p1); });
+    }
+
+    // Releasing an object expires all pointers to it
+    strings.release(p1);
+    assert(strings.size() == 0);
+    assert_throws<expired_pointer>([&] { *p2; });
+    assert_throws<expired_pointer>([&] { strings.release(p1); });
+
+    // The storage is reused, but old pointers stay expired
+    ptr<std::string> p3 = strings.make("World");
+    assert_throws<expired_pointer>([&] { *p1; });
+    assert(***p3 == "World");
+    strings.release(p3);
+
+    // Without outstanding pointers, the lifetime record is reused too
+    for (int i = 0; i < 100; i++)
+      strings.release(strings.make("x"));
+    assert(strings.capacity() == pool<std::string>::first_slab_size);
+  }
+
+  // Pointers to self
+  {
+    auto n1 = std::make_unique<node>(), n2 = std::make_unique<node>();
+    n1->next = n2->self();
+    n2->next = n1->self();
+    n1->next->value = 42;
+    assert(n2->read()->value == 42);
+
+    {
+      auto w = n1->write();
+      assert_throws<invalid_write>([&] { n1->write(); });
+      assert_throws<invalid_write>([&] { *n2->next; });
+      assert_throws<invalid_read>([&] { n1->read(); });
+    }
+
+    // Break the cycle before destroying the nodes
+    n1->next = nullptr;
+    n2->next = nullptr;
+  }
+
+  {
+    // In weak mode, pointers can outlive the object
+    auto n = std::make_unique<weak_node>();
+    ptr<weak_node> p = n->self();
+    p->value = 1;
+    n.reset();
+    assert_throws<expired_pointer>([&] { *p; });
+  }
+
+  // Value arrays
+  {
+    // Like std::vector<value<int>>, but with one byte of borrow state per
+    // element
+    value_array<int> counters(1000);
+    counters[1] = 2;
+    assert(*counters.read(1) == 2);
+
+    {
+      auto w = counters.write(1);
+      assert_throws<invalid_write>([&] { counters.write(1); });
+      assert_throws<invalid_read>([&] { counters.read(1); });
+
+      // Other elements can be borrowed independently
+      counters[2] = 3;
+
+      // Bulk reads need all writers to be released
+      assert_throws<invalid_read>([&] { counters.read_all(); });
+    }
+
+    {
+      auto r1 = counters.read(1);
+      auto r2 = r1;
+      assert_throws<invalid_write>([&] { counters.write(1); });
+    }
+
+    int sum = 0;
+    {
+      auto all = counters.read_all();
+      for (int c : all)
+        sum += c;
+      assert_throws<invalid_write>([&] { counters.write(0); });
+    }
+    assert(sum == 5);
+    assert_throws<std::out_of_range>([&] { counters.read(1000); });
+  }
+
+  // Fixed-size arrays
+  {
+    const safe::array<int, 4> lut = {1, 2, 4, 8};
+
+    // Compile-time indices are checked at compile time
+    assert(*lut.get<3>() == 8);
+    assert(*lut[index_constant<2>()] == 4);
+    // lut.get<4>(); // Does not compile
+
+    // Run-time indices are checked at run-time
+    assert(*lut[1] == 2);
+    assert_throws<std::out_of_range>([&] { lut[4]; });
+
+    // A single value does not convert to an array
+    static_assert(!std::is_convertible_v<int, safe::array<int, 4>>);
+    safe::array<int, 4> single(5);
+    assert(*single[0] == 5);
+
+    safe::array<int, 4> copy = lut;
+    {
+      auto w = copy.get<0>();
+      *w = 16;
+      assert_throws<invalid_write>([&] { copy.get<0>(); });
+      assert_throws<invalid_read>([&] { copy.read_all(); });
+      copy[1] = 32;
+    }
+    int sum = 0;
+    for (int x : copy.read_all())
+      sum += x;
+    assert(sum == 60);
+  }
+
+  // Small vectors
+  {
+    small_vector<std::string, 2> vec = {"a"};
+    vec.push_back("b");
+
+    {
+      // Growing beyond the inline storage moves the elements, so it is
+      // checked like any other write
+      auto r = vec.read().front();
+      assert_throws<invalid_write>([&] { vec.push_back("c"); });
+    }
+
+    vec.push_back("c");
+    assert(vec.size() == 3);
+    assert(*vec.read().front() == "a");
+    assert(*vec.read().back() == "c");
+    assert_throws<std::out_of_range>([&] { vec[3]; });
+
+    std::string all;
+    for (auto s : vec.read())
+      all += *s;
+    assert(all == "abc");
+
+    small_vector<std::string, 2> copy = vec;
+    vec.resize(1);
+    assert(copy.size() == 3 && vec.size() == 1);
+
+    {
+      // Including through a write borrow
+      small_vector<std::string, 2> sv = {"a", "b"};
+      auto w = sv.write();
+      {
+        auto e = w[0];
+        assert_throws<invalid_write>([&] { w.push_back("c"); });
+        assert_throws<invalid_write>([&] { w.emplace_back("c"); });
+        assert_throws<invalid_write>([&] { w.resize(4); });
+        assert_throws<invalid_write>([&] { w.clear(); });
+        assert(**e == "a");
+      }
+      w.push_back("c");
+      assert(w.size() == 3);
+    }
+  }
+
+  // String views
+  {
+    safe::string str = "Hello, world!";
+    {
+      safe::string_view v = str;
+      assert(v.size() == 13);
+      assert(v.find("world") == 7);
+      assert(v.starts_with("Hello"));
+
+      // Substrings share the borrow without copying
+      auto w = v.substr(7, 5);
+      assert(w == "world");
+      assert(v < w);
+      assert(w[0] == 'w');
+      assert_throws<std::out_of_range>([&] { w[5]; });
+      assert_throws<std::out_of_range>([&] { v.substr(14); });
+
+      // The string cannot be modified whilst it is viewed
+      assert_throws<invalid_write>([&] { str.push_back('!'); });
+      assert_throws<invalid_write>([&] { str[0]; });
+      str.read();
+    }
+    str.push_back('!');
+
+    {
+      // A string cannot be viewed whilst an element is borrowed
+      auto c = str[0];
+      assert_throws<invalid_read>([&] { safe::string_view v = str; });
+    }
+
+    auto fn = []() {
+      safe::string str = "abc";
+      return safe::string_view(str); // std::terminate() called
+    };
+  }
+
+  // Bulk string operations
+  {
+    safe::string str = "Hello, World";
+    assert(str.find("World") == 7);
+    assert(str.find('o', 5) == 8);
+    assert(str.rfind('o') == 8);
+    assert(str.starts_with("Hello"));
+    assert(str.ends_with("World"));
+    assert(str.contains(", "));
+    assert(str.compare("Hello, World") == 0);
+
+    str.append("!").replace(0, 5, "Goodbye");
+    str += "?";
+    str.insert(0, ">").erase(1, 1);
+    str.to_upper();
+    assert(str.compare(">OODBYE, WORLD!?") == 0);
+    str.to_lower();
+    assert(str.ends_with("world!?"));
+    assert_throws<std::out_of_range>([&] { str.erase(100); });
+
+    {
+      // Modifying the string checks for element borrows once
+      auto w = str.write();
+      auto c = w[0];
+      assert_throws<invalid_write>([&] { w.append("x"); });
+      assert_throws<invalid_write>([&] { w.to_upper(); });
+      assert_throws<invalid_read>([&] { w.find("world"); });
+    }
+    assert(str.find("world") == 9);
+
+    {
+      auto r = str.read();
+      assert(r.contains("world"));
+      assert_throws<invalid_write>([&] { str.to_upper(); });
+    }
+  }
+  // Ropes
+  {
+    safe::rope<> text = "Hello World";
+    text.insert(5, ",");
+    text.append("!");
+    assert(text.str() == "Hello, World!");
+    text.erase(0, 7);
+    assert(text.str() == "World!");
+    assert(text.at(0) == 'W');
+    assert_throws<std::out_of_range>([&] { text.at(6); });
+
+    // Large edits are split into chunks
+    std::string big(5000, 'x');
+    text.insert(5, big);
+    assert(text.size() == 5006);
+    assert(text.chunk_count() > 1);
+    text.erase(5, 5000);
+    assert(text.str() == "World!");
+
+    text.insert(0, big);
+    {
+      // Edits elsewhere do not invalidate the borrow
+      auto s = text.read(5000, 6);
+      assert(s == "World!");
+      text.insert(0, "abc");
+      text.erase(0, 1000);
+      text.append("??");
+      assert(s == "World!");
+      assert(s[5] == '!');
+
+      // Edits inside borrowed chunks are not allowed
+      assert_throws<invalid_write>([&] { text.erase(text.size() - 4, 1); });
+      assert_throws<invalid_write>([&] { text.insert(text.size() - 4, "x"); });
+      assert(text.str().ends_with("World!??"));
+    }
+    text.erase(text.size() - 2, 2);
+    assert(text.str().ends_with("xWorld!"));
+
+    {
+      // A failed erase leaves the rope unchanged
+      auto before = text.str();
+      assert(text.chunk_count() > 2);
+      auto s = text.read(text.size() - 3, 3);
+      assert_throws<invalid_write>([&] { text.erase(0, text.size()); });
+      assert(text.str() == before);
+    }
+
+    auto fn = []() {
+      safe::rope<> text = "abc";
+      return text.read(0, 1); // std::terminate() called
+    };
+  }
+  // Persistent vectors
+  {
+    safe::persistent_vector<int> vec;
+    for (int i = 0; i < 100; ++i)
+      vec.push_back(i);
+    auto s = vec.snapshot();
+
+    // Writes do not affect the snapshot
+    vec.set(50, -1);
+    *vec.write(0) = -2;
+    vec.pop_back();
+    assert(*vec.read(50) == -1 && *vec[0] == -2);
+    assert(vec.size() == 99 && s.size() == 100);
+    assert(*s[50] == 50 && *s[0] == 0 && *s.at(99) == 99);
+    assert_throws<std::out_of_range>([&] { s.at(100); });
+
+    {
+      // Snapshots can be read on other threads whilst the vector changes
+      std::thread t([&] {
+        for (int i = 0; i < 100; ++i)
+          assert(*s[i] == i);
+      });
+      for (int i = 0; i < 99; ++i)
+        vec.set(i, 0);
+      t.join();
+    }
+
+    {
+      // Borrows of the snapshot do not affect the vector
+      auto r = s[0];
+      vec.set(0, 1);
+    }
+
+    {
+      auto w = vec.write(1);
+      assert_throws<invalid_read>([&] { vec.snapshot(); });
+      assert_throws<invalid_write>([&] { vec.push_back(1); });
+    }
+
+    safe::persistent_vector<int> restored = s;
+    assert(*restored[50] == 50);
+
+    auto fn = []() {
+      safe::persistent_vector<int> vec = {1, 2, 3};
+      return vec[0]; // std::terminate() called
+    };
+  }
+  // Copy-on-write values
+  {
+    safe::cow<std::vector<int>> config(1000, 42);
+    auto copy = config;
+    assert(config.shared() && copy.shared());
+
+    {
+      // Borrows of one copy do not affect the other copies
+      auto r = config.read();
+      copy.write()->push_back(1);
+      assert(!config.shared() && !copy.shared());
+      assert(r->size() == 1000 && copy.read()->size() == 1001);
+      assert_throws<invalid_write>([&] { config.write(); });
+    }
+
+    // Writing to an unshared payload does not copy it
+    auto p = &*config.read();
+    config.write()->at(0) = 1;
+    assert(&*config.read() == p);
+
+    copy = config;
+    assert(copy.read()->at(0) == 1 && copy.shared());
+
+    {
+      // A payload that is being written cannot be shared
+      auto w = config.write();
+      assert_throws<invalid_read>([&] { auto c = config; });
+    }
+
+    auto fn = []() {
+      safe::cow<int> x = 1;
+      return x.read(); // std::terminate() called
+    };
+  }
+  // Frozen containers
+  {
+    safe::vector<int> vec = {1, 2, 3};
+    {
+      auto r = vec[0];
+      assert_throws<invalid_write>([&] { safe::freeze(std::move(vec)); });
+    }
+    auto table = safe::freeze(std::move(vec));
+    assert(table.size() == 3);
+
+    {
+      auto v = table.view();
+      auto w = v;
+      assert(v[0] == 1 && w.at(2) == 3 && v.back() == 3);
+      assert_throws<std::out_of_range>([&] { v[3]; });
+      int sum = 0;
+      for (auto i : v)
+        sum += i;
+      assert(sum == 6);
+    }
+
+    auto fn = []() {
+      auto table = safe::freeze(safe::vector<int>{1, 2, 3});
+      return table.view(); // std::terminate() called
+    };
+  }
+  // Memory-mapped arrays
+  {
+    auto path = std::filesystem::temp_directory_path() / "safe_mapped_array";
+    {
+      std::ofstream file(path, std::ios::binary);
+      for (int i = 0; i < 100; ++i)
+        file.write(reinterpret_cast<const char *>(&i), sizeof(i));
+    }
+
+    safe::mapped_array<int> table(path);
+    assert(table.size() == 100);
+    assert(*table[10] == 10 && *table.at(99) == 99);
+    assert_throws<std::out_of_range>([&] { table.at(100); });
+
+    {
+      auto s = table.span(10, 20);
+      auto t = s.subspan(5, 5);
+      assert(s.size() == 20 && s[0] == 10 && t[0] == 15);
+      assert_throws<std::out_of_range>([&] { s[20]; });
+      assert_throws<std::out_of_range>([&] { table.span(90, 20); });
+
+      // The file cannot be unmapped whilst it is borrowed
+      assert_throws<invalid_write>([&] { table.unmap(); });
+    }
+    table.unmap();
+    assert(!table.is_mapped() && table.empty());
+
+    assert_throws<std::system_error>(
+        [&] { safe::mapped_array<int> missing(path.string() + ".missing"); });
+    std::filesystem::remove(path);
+  }
+  // I/O buffers
+  {
+    int fds[2];
+    assert(pipe(fds) == 0);
+
+    safe::io_buffer in(16), out(8);
+    assert(::write(fds[1], "Hello, World", 12) == 12);
+    assert(in.read_from(fds[0]) == 12);
+    assert(in.size() == 12 && in.available() == 4);
+
+    {
+      auto v = in.data();
+      assert(std::string(v.begin(), v.end()) == "Hello, World");
+
+      // Views prevent the storage from being moved or consumed
+      assert_throws<invalid_write>([&] { in.reserve(100); });
+      assert_throws<invalid_write>([&] { in.consume(1); });
+
+      // More bytes can be read whilst committed bytes are borrowed
+      auto w = in.prepare(2);
+      assert_throws<invalid_write>([&] { in.prepare(); });
+      std::memcpy(w.data(), "!!", 2);
+      w.commit(2);
+      assert_throws<std::out_of_range>([&] { w.commit(1); });
+      assert(v.size() == 12 && in.size() == 14);
+    }
+
+    // Scatter and gather
+    {
+      assert(safe::writev(fds[1], in.data(), in.data()) == 28);
+      auto w1 = in.prepare(), w2 = out.prepare();
+      assert(safe::readv(fds[0], w1, w2) == 10);
+    }
+    assert(in.size() == 16 && out.size() == 8);
+    in.consume(14);
+    assert(in.data()[0] == 'H' && in.data()[1] == 'e');
+    in.compact();
+    assert(in.available() == 14);
+    assert(in.read_from(fds[0]) == 14);
+
+    in.reserve(64);
+    assert(in.capacity() == 64 && in.size() == 16);
+    assert(in.write_to(fds[1]) == 16 && in.empty());
+
+    close(fds[0]);
+    close(fds[1]);
+  }
+  // Binary serialization
+  {
+    safe::vector<double> numbers = {1.5, 2.5, 3.5};
+    safe::string name = "table";
+    safe::vector<safe::vector<int>> rows;
+    rows.emplace_back(std::vector<int>{1, 2});
+    rows.emplace_back();
+    rows.emplace_back(std::vector<int>{3, 4, 5});
+
+    safe::binary_writer writer;
+    writer.write(numbers).write(name).write(rows);
+
+    {
+      // Writing needs to borrow the container
+      auto w = numbers.write();
+      assert_throws<invalid_read>([&] { writer.write(numbers); });
+    }
+
+    auto path = std::filesystem::temp_directory_path() / "safe_serialize";
+    writer.save(path);
+
+    // Views over a mapped file
+    {
+      safe::mapped_array<char> file(path);
+      safe::binary_reader<> reader(file);
+      auto n = reader.read_array<double>();
+      assert(n.size() == 3 && n[2] == 3.5);
+      assert(reader.read_array<char>().str() == "table");
+      assert(reader.read_list() == 3);
+      assert(reader.read_array<int>().size() == 2);
+      assert(reader.read_array<int>().empty());
+      auto row = reader.read_array<int>();
+      assert(row[0] == 3 && row.at(2) == 5);
+      assert(reader.at_end());
+      assert_throws<invalid_write>([&] { file.unmap(); });
+    }
+
+    // Loading into containers
+    {
+      safe::binary_reader<> reader(writer.release());
+      safe::vector<double> numbers2;
+      safe::string name2;
+      safe::vector<safe::vector<int>> rows2;
+      reader.read(numbers2);
+      reader.read(name2);
+      reader.read(rows2);
+      assert(numbers2.size() == 3 && *numbers2[1] == 2.5);
+      assert(name2.compare("table") == 0);
+      assert(rows2.size() == 3);
+      safe::binary_writer w1, w2;
+      w1.write(rows);
+      w2.write(rows2);
+      assert(w1.size() == w2.size() &&
+             std::memcmp(w1.data(), w2.data(), w1.size()) == 0);
+    }
+
+    // Mismatched types are detected
+    {
+      safe::binary_writer writer;
+      writer.write(numbers);
+      safe::binary_reader<> reader(writer.release());
+      assert_throws<invalid_format>([&] { reader.read_array<int>(); });
+      assert_throws<invalid_format>(
+          [&] { safe::binary_reader<> bad(std::vector<char>(8)); });
+
+      // Types of the same size
+      safe::vector<int> ints = {1, 2};
+      writer.write(ints);
+      safe::binary_reader<> reader2(writer.release());
+      assert_throws<invalid_format>([&] { reader2.read_array<float>(); });
+      assert_throws<invalid_format>([&] { reader2.read_array<unsigned>(); });
+      assert_throws<invalid_format>([&] { reader2.read_list(); });
+      assert(reader2.read_array<int>()[1] == 2);
+    }
+    std::filesystem::remove(path);
+  }
+  // Shared memory
+  {
+    auto name = "/safe_test_" + std::to_string(getpid());
+    auto table = safe::shm_value<int>::create(name, 42);
+    auto list = safe::shm_vector<int>::create(name + "_list", 4);
+    assert_throws<std::system_error>(
+        [&] { safe::shm_value<int>::create(name); });
+
+    list.push_back(1);
+    list.push_back(2);
+    {
+      auto r = list.read(0);
+      list.push_back(3);
+      assert_throws<invalid_write>([&] { list.write(1); });
+      assert_throws<invalid_write>([&] { list.pop_back(); });
+    }
+    *list.write(1) = 20;
+    assert(*list.read(1) == 20 && list.size() == 3);
+    assert_throws<std::out_of_range>([&] { list.read(3); });
+    list.push_back(4);
+    assert_throws<std::length_error>([&] { list.push_back(5); });
+
+    // Borrows are checked across processes
+    int ready[2], done[2];
+    assert(pipe(ready) == 0 && pipe(done) == 0);
+    auto child = fork();
+    if (child == 0) {
+      auto t = safe::shm_value<int>::open(name);
+      auto r = t.read();
+      auto l = safe::shm_vector<int>::open(name + "_list");
+      auto w = l.write(3);
+      char c = *r == 42;
+      (void)!::write(ready[1], &c, 1);
+      (void)!::read(done[0], &c, 1);
+      _exit(0); // Exit without releasing the borrows
+    }
+    char c = 0;
+    assert(::read(ready[0], &c, 1) == 1 && c == 1);
+    assert_throws<invalid_write>([&] { table.write(); });
+    assert(*table.read() == 42);
+    assert_throws<invalid_read>([&] { list.read(0); });
+    assert(::write(done[1], &c, 1) == 1);
+    waitpid(child, nullptr, 0);
+
+    // The borrows of the process that exited are still held until recovered
+    assert_throws<invalid_write>([&] { table.write(); });
+    assert(table.recover() == 1);
+    *table.write() = 43;
+    assert(list.recover() == -1); // A writer died
+    assert(*list.read(0) == 1);
+
+    safe::shm_value<int>::remove(name);
+    safe::shm_vector<int>::remove(name + "_list");
+    for (int fd : {ready[0], ready[1], done[0], done[1]})
+      close(fd);
+  }
+  // Single-producer/single-consumer rings
+  {
+    safe::spsc_ring<int, 8> ring;
+    {
+      auto w = ring.write(5);
+      assert(w.size() == 5);
+      for (int i = 0; i < 5; ++i)
+        *w[i] = i;
+      assert_throws<invalid_write>([&] { ring.write(); });
+      {
+        auto slot = w[0];
+        assert_throws<invalid_write>([&] { w.commit(); });
+      }
+      w.commit(3);
+      assert(ring.size() == 3 && w.size() == 2);
+    }
+
+    {
+      auto r = ring.read();
+      assert(r.size() == 3 && *r[2] == 2);
+      assert_throws<std::out_of_range>([&] { r[3]; });
+      {
+        // A slot cannot be released whilst it is referenced
+        auto slot = r[0];
+        assert_throws<invalid_write>([&] { r.release(); });
+      }
+      r.release(1);
+      assert(*r[0] == 1);
+    }
+
+    // Unreleased slots are read again
+    assert(*ring.try_pop() == 1 && *ring.try_pop() == 2);
+    assert(!ring.try_pop());
+
+    // Batches do not wrap around the end of the ring
+    assert(ring.write().size() == 5);
+
+    std::thread producer([&] {
+      for (int i = 0; i < 10000;) {
+        auto w = ring.write();
+        std::size_t n = 0;
+        for (; n < w.size() && i < 10000; ++n)
+          *w[n] = i++;
+        w.commit(n);
+      }
+    });
+    for (int expected = 0; expected < 10000;) {
+      auto r = ring.read();
+      for (std::size_t i = 0; i < r.size(); ++i)
+        assert(*r[i] == expected++);
+      r.release();
+    }
+    producer.join();
+  }
+  // Channels
+  {
+    safe::channel<safe::vector<int>> ch(2);
+    safe::vector<int> vec = {1, 2, 3};
+    {
+      // Borrowed values cannot be sent
+      auto r = vec[0];
+      assert_throws<invalid_write>([&] { ch.send(std::move(vec)); });
+    }
+    assert(vec.size() == 3);
+    ch.send(std::move(vec));
+    assert(ch.try_send(safe::vector<int>{4}));
+
+    safe::vector<int> extra = {5};
+    assert(!ch.try_send(std::move(extra)));
+    assert(extra.size() == 1);
+
+    auto received = ch.recv();
+    assert(received && received->size() == 3 && *received->at(2) == 3);
+    assert(ch.try_recv()->size() == 1);
+    assert(!ch.try_recv());
+
+    // Many senders and receivers
+    safe::channel<int> numbers(16);
+    std::vector<std::thread> senders;
+    for (int t = 0; t < 4; ++t)
+      senders.emplace_back([&] {
+        std::vector<int> batch(1000, 1);
+        assert(numbers.send_all(std::move(batch)) == 1000);
+      });
+    std::atomic<int> total = 0;
+    std::vector<std::thread> receivers;
+    for (int t = 0; t < 2; ++t)
+      receivers.emplace_back([&] {
+        int buffer[10];
+        while (auto n = numbers.recv_many(buffer, 10))
+          for (std::size_t i = 0; i < n; ++i)
+            total += buffer[i];
+      });
+    for (auto &t : senders)
+      t.join();
+    numbers.close();
+    for (auto &t : receivers)
+      t.join();
+    assert(total == 4000);
+    assert(!numbers.recv());
+    assert_throws<closed_channel>([&] { numbers.send(1); });
+
+    // Values are moved through the channel, not copied
+    safe::channel<safe::value<copy_counter>> moves(1);
+    safe::value<copy_counter> payload;
+    moves.send(std::move(payload));
+    auto moved = moves.recv();
+    assert(moved && copy_counter::copies == 0);
+
+    // Closing part way through send_all() leaves the rest of the values
+    safe::channel<safe::vector<int>> small(2);
+    std::vector<safe::vector<int>> batch(4, safe::vector<int>{1});
+    std::size_t sent = 0;
+    std::thread sender([&] { sent = small.send_all(std::move(batch)); });
+    while (small.size() < 2)
+      std::this_thread::yield();
+    small.close();
+    sender.join();
+    assert(sent == 2);
+    assert(batch[2].size() == 1 && batch[3].size() == 1);
+    assert(small.recv()->size() == 1 && small.recv()->size() == 1);
+    assert(!small.recv());
+  }
+  // Coroutine borrows
+  {
+    safe::async_value<std::string> log;
+    safe::executor ex;
+    int readers = 0;
+    ex.spawn(append_twice(log, 'a'));
+    ex.spawn(append_twice(log, 'b'));
+    ex.spawn(count_reads(log, readers));
+    ex.spawn(count_reads(log, readers));
+    ex.run();
+
+    // Conflicting borrows waited in order, instead of throwing
+    assert(ex.pending() == 0 && readers == 2);
+    assert(*log.read() == "abab");
+
+    {
+      auto r = log.read();
+      assert_throws<invalid_write>([&] { log.write(); });
+    }
+
+    ex.spawn(throw_invalid_write(log));
+    assert_throws<invalid_write>([&] { ex.run(); });
+
+    // Releasing a sync borrow outside run() posts the waiting task
+    {
+      auto w = log.write();
+      ex.spawn(count_reads(log, readers));
+      ex.run();
+      assert(ex.pending() == 1 && readers == 2);
+    }
+    assert(ex.pending() == 1 && readers == 2);
+    ex.run();
+    assert(ex.pending() == 0 && readers == 3);
+
+    // Destroying an executor destroys its waiting and posted tasks, and
+    // releases their borrows
+    {
+      safe::executor ex2;
+      auto w = log.write();
+      ex2.spawn(count_reads(log, readers));
+      ex2.spawn(append_twice(log, 'c'));
+      ex2.run();
+    }
+    {
+      safe::executor ex2;
+      {
+        auto w = log.write();
+        ex2.spawn(count_reads(log, readers));
+        ex2.run();
+      }
+    }
+    assert(readers == 3);
+    log.write();
+
+    assert_throws<std::logic_error>([&] {
+      auto y = safe::yield();
+      y.await_suspend(std::noop_coroutine());
+    });
+  }
+  // Scheduled tasks
+  {
+    safe::value<int, checked> total = 0, doubled = 0, other = 0;
+    safe::scheduler s(4);
+
+    // Conflicting tasks run in the order they were submitted
+    for (int i = 0; i < 100; ++i)
+      s.submit([](auto t) { ++**t; }, safe::writes(total));
+    s.submit([](auto t, auto d) { **d = *t * 2; }, safe::reads(total),
+             safe::writes(doubled));
+    s.submit([](auto t) { **t = 5; }, safe::writes(total));
+    s.wait();
+    assert(*total.read() == 5 && *doubled.read() == 200);
+
+    // Readers of the same value run in parallel
+    std::atomic<int> running = 0;
+    auto reader = [&](auto) {
+      ++running;
+      for (int i = 0; i < 5000 && running < 2; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      assert(running >= 2);
+    };
+    s.submit(reader, safe::reads(total));
+    s.submit(reader, safe::reads(total));
+    s.wait();
+
+    // Writing a value that was declared as read is still checked
+    s.submit([&](auto) { total.write(); }, safe::reads(total));
+    assert_throws<invalid_write>([&] { s.wait(); });
+
+    s.submit([](auto) { throw std::runtime_error("task failed"); },
+             safe::writes(other));
+    assert_throws<std::runtime_error>([&] { s.wait(); });
+    assert(*total.read() == 5);
+  }
+  // Borrowing several objects at once
+  {
+    value<int> a = 10, b = 20;
+    {
+      auto [from, to] = safe::borrow_all(safe::writes(a), safe::writes(b));
+      **from -= 5;
+      **to += 5;
+      assert_throws<invalid_read>([&] { a.read(); });
+    }
+    assert(*a.read() == 5 && *b.read() == 25);
+
+    {
+      // All or nothing: a is not left borrowed when b fails
+      auto r = b.read();
+      assert_throws<invalid_write>(
+          [&] { safe::borrow_all(safe::writes(a), safe::writes(b)); });
+      assert_throws<invalid_write>(
+          [&] { safe::borrow_all(safe::writes(b), safe::writes(a)); });
+      a.write();
+      auto [x, y] = safe::borrow_all(safe::reads(b), safe::reads(a));
+      assert(*x == 25 && *y == 5);
+    }
+
+    // Disjoint element borrows
+    safe::vector<int> v = {1, 2, 3, 4};
+    {
+      auto [w, x] = safe::borrow_all(safe::writes(v), safe::reads(a));
+      w.push_back(*x);
+      assert_throws<invalid_read>([&] { v.read(); });
+    }
+    assert(v.size() == 5);
+    v.write().resize(4);
+    {
+      auto e = v.get_many(0, 3);
+      std::swap(**e[0], **e[1]);
+      assert_throws<invalid_write>([&] { v[1]; });
+      assert_throws<invalid_write>([&] { v.push_back(5); });
+      assert_throws<invalid_write>([&] { v.get_many(1); });
+    }
+    assert(v.read()[0] == 4 && v.read()[3] == 1);
+    assert_throws<invalid_write>([&] { v.get_many(1, 1); });
+    assert_throws<std::out_of_range>([&] { v.get_many(1, 4); });
+    v.push_back(5);
+  }
   return 0;
 }
\ No newline at end of file